@@ -0,0 +1,145 @@
+//
+//  framededup.cpp
+//  ffmpeg-experiments
+//
+
+#include "framededup.hpp"
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+    #include <libavutil/imgutils.h>
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const int BLOCK_SIZE = 16; // bytes per block row and rows per block, one SSE2 register wide
+
+static void addBlockDifferences(const uint8_t *a, const uint8_t *b, int length, uint32_t *blockSums) {
+    // adds the absolute differences of one row to the sum of the block each byte falls in
+    int i = 0;
+#if defined(__SSE2__)
+    // psadbw sums the absolute differences of 16 bytes into two 64 bit lanes
+    for(; i + BLOCK_SIZE <= length; i += BLOCK_SIZE) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+        __m128i sad = _mm_sad_epu8(x, y);
+        blockSums[i / BLOCK_SIZE] += _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+    }
+#endif
+    for(; i < length; i++) {
+        blockSums[i / BLOCK_SIZE] += abs(a[i] - b[i]);
+    }
+}
+
+FrameDeduplicator::FrameDeduplicator(double threshold) : threshold(threshold), lastPts(AV_NOPTS_VALUE) {
+    reference = av_frame_alloc();
+    held = av_frame_alloc();
+    output = av_frame_alloc();
+}
+
+FrameDeduplicator::~FrameDeduplicator() {
+    av_frame_free(&reference);
+    av_frame_free(&held);
+    av_frame_free(&output);
+}
+
+bool FrameDeduplicator::isDuplicate(AVFrame *frame) {
+    /**
+        Compares a frame with the last kept frame. Comparing against the kept frame rather than
+        the previous one keeps slow fades from being dropped frame by frame.
+        Kept frames become the new reference.
+        @param frame: a decoded video frame
+        @returns true if the frame should be dropped
+     */
+    if(frame->pts != AV_NOPTS_VALUE) lastPts = frame->pts;
+    if(reference->buf[0] && maxBlockDifference(reference, frame, threshold) <= threshold) {
+        return true;
+    }
+    av_frame_unref(reference);
+    if(av_frame_ref(reference, frame) < 0) {
+        av_frame_unref(reference); // compare nothing rather than a stale frame
+    }
+    return false;
+}
+
+AVFrame* FrameDeduplicator::hold(AVFrame *frame) {
+    /**
+        Takes over a kept frame and hands back the previous one. The duration of a kept frame is only
+        known once the next one arrives, so frames leave one kept frame late, with pkt_duration
+        covering the run of duplicates dropped after them.
+        @param frame: a kept frame in the encoder time base, its buffers are moved out
+        @returns the previous kept frame, valid until the next call, or NULL for the first frame
+     */
+    av_frame_unref(output);
+    av_frame_move_ref(output, held);
+    av_frame_move_ref(held, frame);
+    return finish(held->pts);
+}
+
+AVFrame* FrameDeduplicator::release() {
+    /**
+        Hands back the last kept frame at the end of the stream, lasting until the end of the final run
+        @returns the frame, or NULL if there is none
+     */
+    av_frame_unref(output);
+    av_frame_move_ref(output, held);
+    return finish(lastPts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : lastPts + 1);
+}
+
+AVFrame* FrameDeduplicator::finish(int64_t endPts) {
+    // one tick of the encoder time base is one frame
+    if(!output->buf[0]) return NULL;
+    if(output->pts != AV_NOPTS_VALUE && endPts != AV_NOPTS_VALUE && endPts > output->pts) {
+        output->pkt_duration = endPts - output->pts;
+        durations[output->pts] = output->pkt_duration;
+    }
+    return output;
+}
+
+int64_t FrameDeduplicator::packetDuration(int64_t pts) {
+    /**
+        Duration of the encoded packet of a frame handed back by hold or release,
+        since encoders do not carry frame durations over to their packets
+        @returns the duration in the encoder time base, 0 if unknown
+     */
+    std::map<int64_t, int64_t>::iterator duration = durations.find(pts);
+    if(duration == durations.end()) return 0;
+    int64_t result = duration->second;
+    durations.erase(duration);
+    return result;
+}
+
+double FrameDeduplicator::maxBlockDifference(const AVFrame *a, const AVFrame *b, double limit) {
+    /**
+        Largest mean absolute difference per byte of any 16x16 byte block of the luma plane.
+        A local change such as a moving cursor or a line of text appearing on a slide stands out
+        in its block, where a mean over the whole frame would average it away.
+        Stops at the first block above limit.
+        @returns the difference, or a value above limit if the frames are not comparable
+     */
+    if(a->format != b->format || a->width != b->width || a->height != b->height) return limit + 1;
+    int rowBytes = av_image_get_linesize((AVPixelFormat) a->format, a->width, 0);
+    if(rowBytes <= 0 || a->height <= 0) return limit + 1;
+    
+    int columns = (rowBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<uint32_t> blockSums(columns);
+    double largest = 0;
+    for(int top = 0; top < a->height; top += BLOCK_SIZE) {
+        int rows = std::min(BLOCK_SIZE, a->height - top);
+        std::fill(blockSums.begin(), blockSums.end(), 0);
+        for(int y = top; y < top + rows; y++) {
+            addBlockDifferences(a->data[0] + (ptrdiff_t) y * a->linesize[0], b->data[0] + (ptrdiff_t) y * b->linesize[0], rowBytes, blockSums.data());
+        }
+        for(int column = 0; column < columns; column++) {
+            int width = std::min(BLOCK_SIZE, rowBytes - column * BLOCK_SIZE);
+            double difference = (double) blockSums[column] / (width * rows);
+            if(difference > limit) return difference;
+            largest = std::max(largest, difference);
+        }
+    }
+    return largest;
+}
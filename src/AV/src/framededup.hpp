@@ -0,0 +1,46 @@
+//
+//  framededup.hpp
+//  ffmpeg-experiments
+//
+//  Drops decoded video frames that are (near) identical to the last kept frame,
+//  so static content such as screen recordings and slides is not encoded over and over.
+//
+#pragma once
+#ifndef framededup_hpp
+#define framededup_hpp
+
+#include <map>
+#include <stdint.h>
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+typedef struct DedupStats {
+    uint64_t framesIn;
+    uint64_t framesDropped;
+    uint64_t framesEncoded;
+    int64_t encodeMicroseconds; // time spent encoding the kept frames
+} DedupStats;
+
+class FrameDeduplicator {
+public:
+    FrameDeduplicator(double threshold);
+    ~FrameDeduplicator();
+    bool isDuplicate(AVFrame *frame);
+    AVFrame* hold(AVFrame *frame);
+    AVFrame* release();
+    int64_t packetDuration(int64_t pts);
+    static double maxBlockDifference(const AVFrame *a, const AVFrame *b, double limit);
+private:
+    double threshold; // largest mean absolute luma difference of any block at or below which frames count as duplicates
+    AVFrame *reference; // last kept frame
+    AVFrame *held; // last kept frame, until the next one gives its duration
+    AVFrame *output; // frame handed back by hold or release
+    int64_t lastPts; // of the last frame seen, kept or not
+    std::map<int64_t, int64_t> durations; // by pts, for kept frames that are still in the encoder
+    AVFrame* finish(int64_t endPts);
+};
+
+#endif /* framededup_hpp */
@@ -0,0 +1,142 @@
+//
+//  framepool.cpp
+//  ffmpeg-experiments
+//
+
+#include "framepool.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+extern "C" {
+    #include <libavutil/imgutils.h>
+    #include <libavutil/pixdesc.h>
+}
+
+// the free callback only gets the data pointer, so the opaque carries the mapping size
+// for mmap'ed buffers, with the low bit set. Sizes are page multiples so the bit is free
+static const uintptr_t MAPPED_FLAG = 1;
+
+const int FramePool::ALIGNMENT;
+const size_t FramePool::SIZE_CLASS;
+const size_t FramePool::HUGE_PAGE_SIZE;
+
+FramePool::FramePool(bool hugePages) : hugePages(hugePages) {
+}
+
+FramePool::~FramePool() {
+    // the pools are freed once the last of their buffers is returned
+    for(std::map<size_t, AVBufferPool*>::iterator it = pools.begin(); it != pools.end(); ++it) {
+        av_buffer_pool_uninit(&it->second);
+    }
+}
+
+void FramePool::attach(AVCodecContext *decoderContext) {
+    /**
+        Makes a decoder allocate its frames from this pool. Call before avcodec_open2.
+     */
+    decoderContext->opaque = this;
+    decoderContext->get_buffer2 = getBuffer;
+#if FF_API_THREAD_SAFE_CALLBACKS
+    // unless marked thread safe, frame threads hand every buffer request to the main thread. getBuffer locks
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    decoderContext->thread_safe_callbacks = 1;
+#pragma GCC diagnostic pop
+#endif
+}
+
+int FramePool::getBuffer(AVCodecContext *context, AVFrame *frame, int flags) {
+    /**
+        get_buffer2 callback. Video frames get one pooled buffer per plane, with every line
+        aligned to ALIGNMENT. Audio, palette formats and decoders without direct rendering
+        use the default allocator.
+     */
+    FramePool *pool = (FramePool*) context->opaque;
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get((AVPixelFormat) frame->format);
+    if(context->codec_type != AVMEDIA_TYPE_VIDEO || !(context->codec->capabilities & AV_CODEC_CAP_DR1) ||
+       !descriptor || (descriptor->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL))) {
+        return avcodec_default_get_buffer2(context, frame, flags);
+    }
+    
+    // same padding as the default allocator, decoders may write past the visible frame
+    int width = frame->width, height = frame->height;
+    int strideAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(context, &width, &height, strideAlign);
+    int linesizes[4];
+    bool unaligned;
+    do {
+        if(av_image_fill_linesizes(linesizes, (AVPixelFormat) frame->format, width) < 0) return AVERROR(EINVAL);
+        width += width & ~(width - 1);
+        unaligned = false;
+        for(int i = 0; i < 4; i++) {
+            int alignment = FFMAX(strideAlign[i], ALIGNMENT);
+            unaligned |= linesizes[i] % alignment != 0;
+        }
+    } while(unaligned);
+    
+    ptrdiff_t strides[4];
+    size_t planeSizes[4];
+    for(int i = 0; i < 4; i++) strides[i] = linesizes[i];
+    if(av_image_fill_plane_sizes(planeSizes, (AVPixelFormat) frame->format, height, strides) < 0) return AVERROR(EINVAL);
+    
+    for(int i = 0; i < 4 && planeSizes[i] > 0; i++) {
+        frame->buf[i] = pool->getPlane(planeSizes[i] + 16 + ALIGNMENT - 1);
+        if(!frame->buf[i]) {
+            for(int j = 0; j < i; j++) {
+                av_buffer_unref(&frame->buf[j]);
+                frame->data[j] = NULL;
+            }
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesizes[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+AVBufferRef* FramePool::getPlane(size_t size) {
+    // round up to a size class so resolutions and planes of similar size share a pool
+    size_t sizeClass = (size + SIZE_CLASS - 1) / SIZE_CLASS * SIZE_CLASS;
+    AVBufferPool *pool;
+    {
+        std::lock_guard<std::mutex> lock(poolsMutex);
+        AVBufferPool *&entry = pools[sizeClass];
+        if(!entry) entry = av_buffer_pool_init2((int) sizeClass, this, allocate, NULL);
+        pool = entry;
+    }
+    // AVBufferPool is thread safe on its own
+    return pool ? av_buffer_pool_get(pool) : NULL;
+}
+
+AVBufferRef* FramePool::allocate(void *opaque, int size) {
+    FramePool *pool = (FramePool*) opaque;
+    uint8_t *data = NULL;
+    if(pool->hugePages && (size_t) size >= HUGE_PAGE_SIZE) {
+        size_t mappedSize = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void *mapping = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(mapping, mappedSize, MADV_HUGEPAGE); // a hint, regular pages still work
+#endif
+            data = (uint8_t*) mapping;
+            AVBufferRef *buffer = av_buffer_create(data, size, release, (void*) (mappedSize | MAPPED_FLAG), 0);
+            if(!buffer) munmap(mapping, mappedSize);
+            return buffer;
+        }
+    }
+    if(posix_memalign((void**) &data, ALIGNMENT, size) != 0) return NULL;
+    AVBufferRef *buffer = av_buffer_create(data, size, release, NULL, 0);
+    if(!buffer) free(data);
+    return buffer;
+}
+
+void FramePool::release(void *opaque, uint8_t *data) {
+    uintptr_t mapped = (uintptr_t) opaque;
+    if(mapped & MAPPED_FLAG) {
+        munmap(data, mapped & ~MAPPED_FLAG);
+    } else {
+        free(data);
+    }
+}
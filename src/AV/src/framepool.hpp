@@ -0,0 +1,47 @@
+//
+//  framepool.hpp
+//  ffmpeg-experiments
+//
+//  Per-job pools of aligned frame buffers for the decoders, handed out through a custom
+//  get_buffer2 so sustained decodes reuse buffers instead of churning the allocator.
+//
+#pragma once
+#ifndef framepool_hpp
+#define framepool_hpp
+
+#include <map>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/buffer.h>
+}
+
+typedef struct DecodeStats {
+    uint64_t framesDecoded; // video frames
+    int64_t decodeMicroseconds; // time spent in the video decoders
+    long pageFaults; // of the process while inside the video decode calls, so frame threads decoding in between are missed
+} DecodeStats;
+
+class FramePool {
+public:
+    static const int ALIGNMENT = 64; // a cache line, and enough for AVX-512 loads
+    FramePool(bool hugePages);
+    ~FramePool();
+    void attach(AVCodecContext *decoderContext);
+    static int getBuffer(AVCodecContext *context, AVFrame *frame, int flags);
+private:
+    static const size_t SIZE_CLASS = 4096;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    bool hugePages; // back buffers of at least a huge page with transparent huge pages
+    std::map<size_t, AVBufferPool*> pools; // by size class
+    std::mutex poolsMutex; // frame threaded decoders call getBuffer from several threads
+    AVBufferRef* getPlane(size_t size);
+    static AVBufferRef* allocate(void *opaque, int size);
+    static void release(void *opaque, uint8_t *data);
+};
+
+#endif /* framepool_hpp */
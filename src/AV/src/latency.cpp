@@ -0,0 +1,54 @@
+//
+//  latency.cpp
+//  ffmpeg-experiments
+//
+
+#include "latency.hpp"
+
+extern "C" {
+    #include <libavutil/avutil.h>
+    #include <libavutil/time.h>
+}
+
+LatencyTracker::LatencyTracker() : start(av_gettime_relative()), firstPacket(0), packets(0), totalLatency(0), maxLatency(0) {
+}
+
+void LatencyTracker::frameSent(int streamIndex, int64_t pts) {
+    /**
+        Records when a frame was sent to the encoder
+        @param pts: the frame pts in the encoder time base
+     */
+    if(pts == AV_NOPTS_VALUE) return;
+    // frames the encoder never returns (or returns with other timestamps) must not pile up
+    if(sendTimes.size() >= MAX_PENDING_FRAMES) sendTimes.erase(sendTimes.begin());
+    sendTimes[std::make_pair(streamIndex, pts)] = av_gettime_relative();
+}
+
+void LatencyTracker::packetMuxed(int streamIndex, int64_t pts) {
+    /**
+        Records that a packet was handed to the muxer
+        @param pts: the packet pts in the encoder time base, or AV_NOPTS_VALUE for copied packets
+     */
+    int64_t now = av_gettime_relative();
+    if(!firstPacket) firstPacket = now;
+    if(pts == AV_NOPTS_VALUE) return;
+    
+    std::map<std::pair<int, int64_t>, int64_t>::iterator sent = sendTimes.find(std::make_pair(streamIndex, pts));
+    if(sent == sendTimes.end()) return;
+    int64_t latency = now - sent->second;
+    sendTimes.erase(sent);
+    // the encoder fills its lookahead during the first second, that is startup and not steady state
+    if(now - firstPacket < WARMUP) return;
+    packets++;
+    totalLatency += latency;
+    if(latency > maxLatency) maxLatency = latency;
+}
+
+LatencyStats LatencyTracker::getStats() {
+    LatencyStats stats = {};
+    stats.timeToFirstPacket = firstPacket ? firstPacket - start : 0;
+    stats.packetsMeasured = packets;
+    stats.meanLatency = packets ? totalLatency / packets : 0;
+    stats.maxLatency = maxLatency;
+    return stats;
+}
@@ -0,0 +1,41 @@
+//
+//  latency.hpp
+//  ffmpeg-experiments
+//
+//  Tracks how long frames take from the encoder to the muxer, and how long a job takes to
+//  produce its first output packet.
+//
+#pragma once
+#ifndef latency_hpp
+#define latency_hpp
+
+#include <map>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct LatencyStats {
+    int64_t timeToFirstPacket; // microseconds from the start of the job to the first muxed packet
+    uint64_t packetsMeasured; // steady state packets, the first second of output is left out
+    int64_t meanLatency; // microseconds from sending a frame to the encoder until its packet is muxed
+    int64_t maxLatency;
+} LatencyStats;
+
+class LatencyTracker {
+public:
+    LatencyTracker();
+    void frameSent(int streamIndex, int64_t pts);
+    void packetMuxed(int streamIndex, int64_t pts);
+    LatencyStats getStats();
+private:
+    static const size_t MAX_PENDING_FRAMES = 1024;
+    static const int64_t WARMUP = 1000 * 1000;
+    std::map<std::pair<int, int64_t>, int64_t> sendTimes; // by output stream and encoder pts
+    int64_t start;
+    int64_t firstPacket;
+    uint64_t packets;
+    int64_t totalLatency;
+    int64_t maxLatency;
+};
+
+#endif /* latency_hpp */
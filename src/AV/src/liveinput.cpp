@@ -0,0 +1,100 @@
+//
+//  liveinput.cpp
+//  ffmpeg-experiments
+//
+
+#include "liveinput.hpp"
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const int64_t LiveSource::LIVE_PROBE_SIZE;
+const int64_t LiveSource::LIVE_ANALYZE_DURATION;
+const int64_t LiveSource::LIVE_READ_TIMEOUT;
+
+LiveSource::LiveSource() : fd(-1), ownsFd(false), savedFlags(-1) {
+}
+
+LiveSource::~LiveSource() {
+    if(fd < 0) return;
+    if(ownsFd) {
+        close(fd);
+    } else if(savedFlags >= 0) {
+        fcntl(fd, F_SETFL, savedFlags); // stdin is shared with the parent, put it back
+    }
+}
+
+int LiveSource::open(LiveInput &input, std::string &url, AVDictionary **options) {
+    /**
+        Resolves a LiveInput to a URL and protocol options for avformat_open_input.
+        Stdin and FIFOs are made non-blocking and handed to the pipe protocol, so libavformat
+        polls them and rw_timeout ends the input once no data arrives for readTimeout.
+        @param input: the live input to open
+        @param url: receives the URL to open
+        @param options: receives the protocol options
+        @returns 0 if successful, -1 if an error occured
+     */
+    int64_t readTimeout = input.readTimeout > 0 ? input.readTimeout : LIVE_READ_TIMEOUT;
+    av_dict_set_int(options, "rw_timeout", readTimeout, 0);
+    
+    if(input.url.compare(0, 6, "udp://") == 0) {
+        url = input.url;
+        av_dict_set_int(options, "timeout", readTimeout, 0);
+        av_dict_set(options, "overrun_nonfatal", "1", 0); // drop on bursts rather than failing the job
+        return 0;
+    }
+    
+    if(input.url == "-") {
+        fd = STDIN_FILENO;
+        ownsFd = false;
+    } else {
+        struct stat info;
+        if(stat(input.url.c_str(), &info) < 0) {
+            std::cout << "failed to open live input: " << input.url << "\n";
+            return -1;
+        }
+        if(!S_ISFIFO(info.st_mode)) {
+            // a regular file needs no special handling
+            url = input.url;
+            return 0;
+        }
+        // opening a FIFO non-blocking does not wait for a writer, waitForData does that with a timeout
+        fd = ::open(input.url.c_str(), O_RDONLY | O_NONBLOCK);
+        if(fd < 0) {
+            std::cout << "failed to open live input: " << input.url << "\n";
+            return -1;
+        }
+        ownsFd = true;
+    }
+    
+    savedFlags = fcntl(fd, F_GETFL);
+    if(savedFlags < 0 || fcntl(fd, F_SETFL, savedFlags | O_NONBLOCK) < 0) {
+        std::cout << "failed to make live input non-blocking \n";
+        return -1;
+    }
+    if(waitForData(readTimeout) < 0) return -1;
+    
+    std::ostringstream pipeUrl;
+    pipeUrl << "pipe:" << fd;
+    url = pipeUrl.str();
+    return 0;
+}
+
+int LiveSource::waitForData(int64_t timeout) {
+    /**
+        Waits until the input is readable. A read on a FIFO without a writer returns EOF,
+        so this keeps the demuxer from giving up before the feed has started.
+     */
+    struct pollfd readable = {};
+    readable.fd = fd;
+    readable.events = POLLIN;
+    int ready = poll(&readable, 1, (int) (timeout / 1000));
+    if(ready <= 0) {
+        std::cout << "no data on live input after " << timeout / 1000 << "ms \n";
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+//
+//  liveinput.hpp
+//  ffmpeg-experiments
+//
+//  Live MPEG-TS ingest from stdin, a FIFO or a local UDP socket.
+//
+#pragma once
+#ifndef liveinput_hpp
+#define liveinput_hpp
+
+#include <string>
+#include <stdint.h>
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavformat/avformat.h>
+}
+
+typedef struct LiveInput {
+    std::string url; // "-" for stdin, a FIFO path, or udp://127.0.0.1:<port>
+    int64_t probeSize; // bytes read to find the streams, 0 uses LIVE_PROBE_SIZE
+    int64_t analyzeDuration; // microseconds of input analyzed, 0 uses LIVE_ANALYZE_DURATION
+    int64_t readTimeout; // microseconds without data before the input counts as ended, 0 uses LIVE_READ_TIMEOUT
+} LiveInput;
+
+class LiveSource {
+public:
+    static const int64_t LIVE_PROBE_SIZE = 1024 * 1024;
+    static const int64_t LIVE_ANALYZE_DURATION = 1000 * 1000;
+    static const int64_t LIVE_READ_TIMEOUT = 5 * 1000 * 1000;
+    LiveSource();
+    ~LiveSource();
+    int open(LiveInput &input, std::string &url, AVDictionary **options);
+private:
+    int fd; // stdin or the FIFO, read non-blocking so reads can time out
+    bool ownsFd;
+    int savedFlags; // flags of fd before it was made non-blocking
+    int waitForData(int64_t timeout);
+};
+
+#endif /* liveinput_hpp */
@@ -0,0 +1,153 @@
+//
+//  mediaio.cpp
+//  ffmpeg-experiments
+//
+
+#include "mediaio.hpp"
+#include <string.h>
+#include <iostream>
+
+MediaSource MediaIO::memorySource(MemoryInput *input) {
+    /**
+        Wraps a memory buffer as a seekable MediaSource. The buffer is not copied,
+        so it has to outlive the transcode.
+        @param input: the buffer to read from
+        @returns a MediaSource reading from the buffer
+     */
+    MediaSource source = {};
+    source.read = readMemory;
+    source.seek = seekMemoryInput;
+    source.opaque = input;
+    return source;
+}
+
+MediaSink MediaIO::memorySink(MemoryOutput *output) {
+    /**
+        Wraps a growable memory buffer as a seekable MediaSink
+        @param output: the buffer to write to
+        @returns a MediaSink writing to the buffer
+     */
+    MediaSink sink = {};
+    sink.write = writeMemory;
+    sink.seek = seekMemoryOutput;
+    sink.opaque = output;
+    return sink;
+}
+
+AVIOContext* MediaIO::openSource(MediaSource &source) {
+    /**
+        Creates a read AVIOContext backed by the callbacks of a MediaSource
+        @returns the AVIOContext, or NULL if an error occured
+     */
+    uint8_t *buffer = (uint8_t*) av_malloc(BUFFER_SIZE);
+    if(!buffer) {
+        std::cout << "failed to allocate memory for input buffer! \n";
+        return NULL;
+    }
+    AVIOContext *avio = avio_alloc_context(buffer, BUFFER_SIZE, 0, source.opaque, source.read, NULL, source.seek);
+    if(!avio) {
+        std::cout << "failed to allocate input IO context! \n";
+        av_free(buffer);
+        return NULL;
+    }
+    avio->seekable = source.seek ? AVIO_SEEKABLE_NORMAL : 0;
+    return avio;
+}
+
+AVIOContext* MediaIO::openSink(MediaSink &sink) {
+    /**
+        Creates a write AVIOContext backed by the callbacks of a MediaSink
+        @returns the AVIOContext, or NULL if an error occured
+     */
+    uint8_t *buffer = (uint8_t*) av_malloc(BUFFER_SIZE);
+    if(!buffer) {
+        std::cout << "failed to allocate memory for output buffer! \n";
+        return NULL;
+    }
+    AVIOContext *avio = avio_alloc_context(buffer, BUFFER_SIZE, 1, sink.opaque, NULL, sink.write, sink.seek);
+    if(!avio) {
+        std::cout << "failed to allocate output IO context! \n";
+        av_free(buffer);
+        return NULL;
+    }
+    avio->seekable = sink.seek ? AVIO_SEEKABLE_NORMAL : 0;
+    return avio;
+}
+
+void MediaIO::close(AVIOContext **avio) {
+    /**
+        Flushes and frees an AVIOContext created by openSource or openSink
+     */
+    if(!*avio) return;
+    if((*avio)->write_flag) avio_flush(*avio);
+    // the buffer may have been reallocated by libavformat, so free the current one
+    av_freep(&(*avio)->buffer);
+    avio_context_free(avio);
+}
+
+int MediaIO::readMemory(void *opaque, uint8_t *buf, int bufSize) {
+    MemoryInput *input = (MemoryInput*) opaque;
+    size_t remaining = input->size - input->position;
+    if(remaining == 0) return AVERROR_EOF;
+    size_t toRead = FFMIN((size_t) bufSize, remaining);
+    memcpy(buf, input->data + input->position, toRead);
+    input->position += toRead;
+    return (int) toRead;
+}
+
+int64_t MediaIO::seekMemoryInput(void *opaque, int64_t offset, int whence) {
+    MemoryInput *input = (MemoryInput*) opaque;
+    int64_t position;
+    switch(whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return (int64_t) input->size;
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = (int64_t) input->position + offset;
+            break;
+        case SEEK_END:
+            position = (int64_t) input->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if(position < 0 || position > (int64_t) input->size) return AVERROR(EINVAL);
+    input->position = (size_t) position;
+    return position;
+}
+
+int MediaIO::writeMemory(void *opaque, uint8_t *buf, int bufSize) {
+    MemoryOutput *output = (MemoryOutput*) opaque;
+    if(output->position + bufSize > output->data->size()) {
+        output->data->resize(output->position + bufSize);
+    }
+    memcpy(output->data->data() + output->position, buf, bufSize);
+    output->position += bufSize;
+    return bufSize;
+}
+
+int64_t MediaIO::seekMemoryOutput(void *opaque, int64_t offset, int whence) {
+    MemoryOutput *output = (MemoryOutput*) opaque;
+    int64_t position;
+    switch(whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return (int64_t) output->data->size();
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = (int64_t) output->position + offset;
+            break;
+        case SEEK_END:
+            position = (int64_t) output->data->size() + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    // seeking past the end is allowed, the gap is zero-filled on the next write
+    if(position < 0) return AVERROR(EINVAL);
+    output->position = (size_t) position;
+    return position;
+}
@@ -0,0 +1,66 @@
+//
+//  mediaio.hpp
+//  ffmpeg-experiments
+//
+//  Custom AVIOContext plumbing so media can be read from and written to
+//  memory (or any callback) instead of the filesystem.
+//
+#pragma once
+#ifndef mediaio_hpp
+#define mediaio_hpp
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavformat/avio.h>
+}
+
+// callbacks follow the AVIOContext contract: read returns the number of bytes read or AVERROR_EOF,
+// write returns the number of bytes written or a negative AVERROR, seek supports AVSEEK_SIZE
+typedef int (*MediaReadCallback)(void *opaque, uint8_t *buf, int bufSize);
+typedef int (*MediaWriteCallback)(void *opaque, uint8_t *buf, int bufSize);
+typedef int64_t (*MediaSeekCallback)(void *opaque, int64_t offset, int whence);
+
+typedef struct MediaSource {
+    MediaReadCallback read;
+    MediaSeekCallback seek; // may be NULL for non-seekable input
+    void *opaque;
+} MediaSource;
+
+typedef struct MediaSink {
+    MediaWriteCallback write;
+    MediaSeekCallback seek; // may be NULL, but muxers such as mp4 need to seek back to write the header
+    void *opaque;
+} MediaSink;
+
+typedef struct MemoryInput {
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+} MemoryInput;
+
+typedef struct MemoryOutput {
+    std::vector<uint8_t> *data; // grows as the muxer writes
+    size_t position;
+} MemoryOutput;
+
+class MediaIO {
+public:
+    static MediaSource memorySource(MemoryInput *input);
+    static MediaSink memorySink(MemoryOutput *output);
+    static AVIOContext* openSource(MediaSource &source);
+    static AVIOContext* openSink(MediaSink &sink);
+    static void close(AVIOContext **avio);
+private:
+    static const int BUFFER_SIZE = 32 * 1024;
+    static int readMemory(void *opaque, uint8_t *buf, int bufSize);
+    static int64_t seekMemoryInput(void *opaque, int64_t offset, int whence);
+    static int writeMemory(void *opaque, uint8_t *buf, int bufSize);
+    static int64_t seekMemoryOutput(void *opaque, int64_t offset, int whence);
+};
+
+#endif /* mediaio_hpp */
@@ -0,0 +1,305 @@
+//
+//  outputcache.cpp
+//  ffmpeg-experiments
+//
+
+#include "outputcache.hpp"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+extern "C" {
+    #include <libavutil/hash.h>
+}
+
+#ifdef TRANSCODER_HAVE_X265
+#include <x265.h>
+#endif
+
+static const int HASH_BUFFER_SIZE = 64 * 1024;
+static const time_t STALE_PARTIAL_SECONDS = 60 * 60;
+static const mode_t ENTRY_MODE = 0444; // entries are never modified once published
+
+static std::string partialName(const std::string &path) {
+    /**
+        Builds a unique temporary name next to path. It keeps the extension so
+        muxers can still guess the format, and starts with a dot so eviction skips it.
+     */
+    static std::atomic<unsigned> counter(0);
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::ostringstream name;
+    name << dir << "/.partial-" << getpid() << "-" << counter++ << "-" << base;
+    return name.str();
+}
+
+static std::string extensionOf(const std::string &path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+    return path.substr(dot);
+}
+
+OutputCache::OutputCache(const std::string &cacheDirectory, uint64_t maxBytes) : directory(cacheDirectory), maxBytes(maxBytes), stats() {
+    if(mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::cout << "could not create cache directory: " << directory << "\n";
+    }
+}
+
+int OutputCache::Transcode(Transcoder &transcoder, std::string &inputFile, std::string &outputFile, StreamParams &streamParams) {
+    /**
+        Transcodes inputFile into outputFile, serving the result from the cache when
+        an identical job has run before. Outputs are written under a temporary name and
+        renamed into place, so neither outputFile nor the cache ever holds a partial file.
+        outputFile never shares its inode with a cache entry: entries are read-only copies,
+        made by reflink where the filesystem supports it, so the caller may edit or truncate
+        the output in place without touching the cache.
+        Jobs that measure quality always transcode, since a hit would produce no quality log,
+        but their output is still published for later jobs.
+        @returns 0 if succesful, -1 otherwise
+     */
+    std::string key;
+    if(makeKey(inputFile, streamParams, key) < 0) return -1;
+    std::string cachePath = directory + "/" + key + extensionOf(outputFile);
+
+    struct stat entry;
+    bool measuringQuality = !streamParams.qualityLogFile.empty();
+    if(!measuringQuality && stat(cachePath.c_str(), &entry) == 0 && placeFile(cachePath, outputFile, 0) == 0) {
+        utime(cachePath.c_str(), NULL); // mark as recently used
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.hits++;
+        stats.bytesServed += entry.st_size;
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.misses++;
+    }
+
+    std::string partialOutput = partialName(outputFile);
+    if(transcoder.Transcode(inputFile, partialOutput, streamParams) < 0) {
+        unlink(partialOutput.c_str());
+        return -1;
+    }
+    if(rename(partialOutput.c_str(), outputFile.c_str()) < 0) {
+        std::cout << "could not move transcoded file to " << outputFile << "\n";
+        unlink(partialOutput.c_str());
+        return -1;
+    }
+    // failing to publish only costs a future hit
+    if(placeFile(outputFile, cachePath, ENTRY_MODE) < 0) {
+        std::cout << "could not add " << outputFile << " to the cache \n";
+        return 0;
+    }
+    evict();
+    return 0;
+}
+
+CacheStats OutputCache::getStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+int OutputCache::makeKey(const std::string &inputFile, StreamParams &streamParams, std::string &key) {
+    /**
+        Hashes the input content together with the stream parameters and library versions
+        @param key: receives the hex encoded SHA-256 key
+        @returns 0 if succesful, -1 otherwise
+     */
+    std::string inputHash;
+    if(hashFile(inputFile, inputHash) < 0) return -1;
+
+    std::ostringstream material;
+    material << "input=" << inputHash << "\n";
+    material << serializeParams(streamParams);
+    material << "avcodec=" << avcodec_version() << "\n";
+    material << "avformat=" << avformat_version() << "\n";
+    material << "avutil=" << avutil_version() << "\n";
+    material << "ffmpeg=" << av_version_info() << "\n";
+    material << "configuration=" << avcodec_configuration() << "\n";
+    // external encoders are upgraded independently of libavcodec
+    material << "encoder=" << encoderVersion(streamParams.videoCodec) << "\n";
+    std::string text = material.str();
+
+    AVHashContext *hash = NULL;
+    if(av_hash_alloc(&hash, "SHA256") < 0) {
+        std::cout << "could not allocate hash context! \n";
+        return -1;
+    }
+    char hex[2 * AV_HASH_MAX_SIZE + 1];
+    av_hash_init(hash);
+    av_hash_update(hash, (const uint8_t*) text.data(), (int) text.size());
+    av_hash_final_hex(hash, (uint8_t*) hex, sizeof(hex));
+    av_hash_freep(&hash);
+    key = hex;
+    return 0;
+}
+
+std::string OutputCache::encoderVersion(const std::string &codecName) {
+    /**
+        Version of the external library behind an encoder wrapper, empty for the encoders
+        built into libavcodec, which its version already covers
+     */
+#ifdef TRANSCODER_HAVE_X265
+    if(codecName == "libx265") return x265_version_str;
+#endif
+    return "";
+}
+
+int OutputCache::hashFile(const std::string &fileName, std::string &hash) {
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if(!file) {
+        std::cout << "could not open input file: " << fileName << "\n";
+        return -1;
+    }
+    AVHashContext *context = NULL;
+    if(av_hash_alloc(&context, "SHA256") < 0) {
+        std::cout << "could not allocate hash context! \n";
+        fclose(file);
+        return -1;
+    }
+    av_hash_init(context);
+    std::vector<uint8_t> buffer(HASH_BUFFER_SIZE);
+    size_t bytesRead;
+    while((bytesRead = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        av_hash_update(context, buffer.data(), (int) bytesRead);
+    }
+    bool failed = ferror(file);
+    fclose(file);
+
+    char hex[2 * AV_HASH_MAX_SIZE + 1];
+    av_hash_final_hex(context, (uint8_t*) hex, sizeof(hex));
+    av_hash_freep(&context);
+    if(failed) {
+        std::cout << "could not read input file: " << fileName << "\n";
+        return -1;
+    }
+    hash = hex;
+    return 0;
+}
+
+std::string OutputCache::serializeParams(StreamParams &streamParams) {
+    /**
+        Canonical serialization of StreamParams: every field in a fixed order, one per line.
+        Add new StreamParams fields here, or different profiles will share cache entries.
+        The quality measurement and frame buffer settings are left out since they do not change the output,
+        jobs measuring quality skip the lookup instead.
+     */
+    std::ostringstream params;
+    params << "copyVideo=" << streamParams.copyVideo << "\n";
+    params << "copyAudio=" << streamParams.copyAudio << "\n";
+    params << "outputExtenstion=" << streamParams.outputExtenstion << "\n";
+    params << "muxerOptKey=" << streamParams.muxerOptKey << "\n";
+    params << "muxerOptValue=" << streamParams.muxerOptValue << "\n";
+    params << "videoCodec=" << streamParams.videoCodec << "\n";
+    params << "audioCodec=" << streamParams.audioCodec << "\n";
+    params << "codecPrivKey=" << streamParams.codecPrivKey << "\n";
+    params << "codecPrivValue=" << streamParams.codecPrivValue << "\n";
+    params << "dropDuplicateFrames=" << streamParams.dropDuplicateFrames << "\n";
+    params << "duplicateThreshold=" << std::setprecision(17) << streamParams.duplicateThreshold << "\n";
+    return params.str();
+}
+
+int OutputCache::placeFile(const std::string &source, const std::string &destination, mode_t mode) {
+    /**
+        Atomically places a copy of source at destination
+        @param mode: permissions of the copy, 0 keeps the default
+     */
+    std::string partial = partialName(destination);
+    if(copyFile(source, partial) < 0 || (mode && chmod(partial.c_str(), mode) < 0)) {
+        unlink(partial.c_str());
+        return -1;
+    }
+    if(rename(partial.c_str(), destination.c_str()) < 0) {
+        unlink(partial.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int OutputCache::copyFile(const std::string &source, const std::string &destination) {
+    FILE *in = fopen(source.c_str(), "rb");
+    if(!in) return -1;
+    FILE *out = fopen(destination.c_str(), "wb");
+    if(!out) {
+        fclose(in);
+        return -1;
+    }
+#ifdef FICLONE
+    // a reflink shares the data copy-on-write, so it is as cheap as a hardlink but a separate file
+    if(ioctl(fileno(out), FICLONE, fileno(in)) == 0) {
+        fclose(in);
+        return fclose(out) == 0 ? 0 : -1;
+    }
+#endif
+    std::vector<uint8_t> buffer(HASH_BUFFER_SIZE);
+    size_t bytesRead;
+    bool failed = false;
+    while(!failed && (bytesRead = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+        failed = fwrite(buffer.data(), 1, bytesRead, out) != bytesRead;
+    }
+    failed = failed || ferror(in);
+    fclose(in);
+    if(fclose(out) != 0) failed = true;
+    return failed ? -1 : 0;
+}
+
+void OutputCache::evict() {
+    /**
+        Removes the least recently used entries until the cache fits in maxBytes.
+        Partial files left behind by crashed jobs are removed once they are stale.
+     */
+    typedef struct CacheEntry {
+        std::string path;
+        uint64_t size;
+        time_t lastUsed;
+    } CacheEntry;
+
+    DIR *dir = opendir(directory.c_str());
+    if(!dir) return;
+    std::vector<CacheEntry> entries;
+    uint64_t totalBytes = 0;
+    time_t now = time(NULL);
+    struct dirent *file;
+    while((file = readdir(dir)) != NULL) {
+        std::string path = directory + "/" + file->d_name;
+        struct stat info;
+        if(stat(path.c_str(), &info) < 0 || !S_ISREG(info.st_mode)) continue;
+        if(file->d_name[0] == '.') {
+            if(now - info.st_mtime > STALE_PARTIAL_SECONDS) unlink(path.c_str());
+            continue;
+        }
+        CacheEntry entry = {path, (uint64_t) info.st_size, info.st_mtime};
+        entries.push_back(entry);
+        totalBytes += entry.size;
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    uint64_t evicted = 0;
+    for(size_t i = 0; i < entries.size() && totalBytes > maxBytes; i++) {
+        if(unlink(entries[i].path.c_str()) == 0) {
+            totalBytes -= entries[i].size;
+            evicted++;
+        }
+    }
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.evictions += evicted;
+}
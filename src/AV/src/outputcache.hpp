@@ -0,0 +1,46 @@
+//
+//  outputcache.hpp
+//  ffmpeg-experiments
+//
+//  Content-addressed cache of transcoded outputs. Entries are keyed by a hash of the
+//  input content, the StreamParams and the library versions, so byte-identical
+//  re-uploads with the same profile are served without re-encoding. Entries are
+//  read-only files of their own, outputs are always separate copies.
+//
+#pragma once
+#ifndef outputcache_hpp
+#define outputcache_hpp
+
+#include <string>
+#include <mutex>
+#include <stdint.h>
+#include <sys/types.h>
+#include "transcoder.hpp"
+
+typedef struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytesServed; // bytes of output served from the cache
+} CacheStats;
+
+class OutputCache {
+public:
+    OutputCache(const std::string &cacheDirectory, uint64_t maxBytes);
+    int Transcode(Transcoder &transcoder, std::string &inputFile, std::string &outputFile, StreamParams &streamParams);
+    CacheStats getStats();
+private:
+    std::string directory;
+    uint64_t maxBytes;
+    CacheStats stats;
+    std::mutex statsMutex;
+    int makeKey(const std::string &inputFile, StreamParams &streamParams, std::string &key);
+    std::string encoderVersion(const std::string &codecName);
+    int hashFile(const std::string &fileName, std::string &hash);
+    std::string serializeParams(StreamParams &streamParams);
+    int placeFile(const std::string &source, const std::string &destination, mode_t mode);
+    int copyFile(const std::string &source, const std::string &destination);
+    void evict();
+};
+
+#endif /* outputcache_hpp */
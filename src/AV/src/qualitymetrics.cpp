@@ -0,0 +1,383 @@
+//
+//  qualitymetrics.cpp
+//  ffmpeg-experiments
+//
+
+#include "qualitymetrics.hpp"
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+    #include <libavutil/pixdesc.h>
+    #include <libavutil/imgutils.h>
+    #include <libavutil/time.h>
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+double QualityMonitor::psnrFromMse(double mse) {
+    /**
+        PSNR of 8 bit samples, infinite for identical frames
+     */
+    if(mse <= 0) return INFINITY;
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+static void ssimSums4x4(const uint8_t *a, int strideA, const uint8_t *b, int strideB, int64_t sums[4]) {
+    /**
+        Sums of a, b, a^2 + b^2 and a*b over a 4x4 block
+     */
+#if defined(__SSE2__)
+    uint32_t rowsA[4], rowsB[4];
+    for(int y = 0; y < 4; y++) {
+        memcpy(&rowsA[y], a + (ptrdiff_t) y * strideA, 4);
+        memcpy(&rowsB[y], b + (ptrdiff_t) y * strideB, 4);
+    }
+    __m128i zero = _mm_setzero_si128();
+    __m128i x = _mm_loadu_si128((const __m128i*) rowsA);
+    __m128i y = _mm_loadu_si128((const __m128i*) rowsB);
+    __m128i sumX = _mm_sad_epu8(x, zero);
+    __m128i sumY = _mm_sad_epu8(y, zero);
+    __m128i xLow = _mm_unpacklo_epi8(x, zero), xHigh = _mm_unpackhi_epi8(x, zero);
+    __m128i yLow = _mm_unpacklo_epi8(y, zero), yHigh = _mm_unpackhi_epi8(y, zero);
+    __m128i squares = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(xLow, xLow), _mm_madd_epi16(xHigh, xHigh)),
+                                    _mm_add_epi32(_mm_madd_epi16(yLow, yLow), _mm_madd_epi16(yHigh, yHigh)));
+    __m128i products = _mm_add_epi32(_mm_madd_epi16(xLow, yLow), _mm_madd_epi16(xHigh, yHigh));
+    uint64_t sadLanes[2];
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*) sadLanes, sumX);
+    sums[0] = sadLanes[0] + sadLanes[1];
+    _mm_storeu_si128((__m128i*) sadLanes, sumY);
+    sums[1] = sadLanes[0] + sadLanes[1];
+    _mm_storeu_si128((__m128i*) lanes, squares);
+    sums[2] = (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i*) lanes, products);
+    sums[3] = (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    sums[0] = sums[1] = sums[2] = sums[3] = 0;
+    for(int y = 0; y < 4; y++) {
+        for(int x = 0; x < 4; x++) {
+            int pa = a[(ptrdiff_t) y * strideA + x];
+            int pb = b[(ptrdiff_t) y * strideB + x];
+            sums[0] += pa;
+            sums[1] += pb;
+            sums[2] += pa * pa + pb * pb;
+            sums[3] += pa * pb;
+        }
+    }
+#endif
+}
+
+static double ssimWindow(const int64_t *s) {
+    /**
+        SSIM of an 8x8 window from its summed 4x4 block sums, with the usual constants for 8 bit video
+     */
+    const double c1 = 0.01 * 0.01 * 255 * 255 * 64;
+    const double c2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+    double s1 = s[0], s2 = s[1], ss = s[2], s12 = s[3];
+    double variance = ss * 64 - s1 * s1 - s2 * s2;
+    double covariance = s12 * 64 - s1 * s2;
+    return ((2 * s1 * s2 + c1) * (2 * covariance + c2)) / ((s1 * s1 + s2 * s2 + c1) * (variance + c2));
+}
+
+QualityMonitor::QualityMonitor() : decoderContext(NULL), decodedFrame(NULL), logFile(NULL), sampleInterval(1), framesSeen(0), ssimTotal(0), minSsim(1), framesMeasured(0), framesSkipped(0), microseconds(0), encodeMicroseconds(0) {
+    memset(squaredErrorTotal, 0, sizeof(squaredErrorTotal));
+    memset(planeSamples, 0, sizeof(planeSamples));
+}
+
+QualityMonitor::~QualityMonitor() {
+    for(std::map<int64_t, AVFrame*>::iterator it = sourceFrames.begin(); it != sourceFrames.end(); ++it) {
+        av_frame_free(&it->second);
+    }
+    av_frame_free(&decodedFrame);
+    avcodec_free_context(&decoderContext);
+    if(logFile) fclose(logFile);
+}
+
+int QualityMonitor::open(AVCodecParameters *encodedParameters, AVRational timeBase, const std::string &logFileName, int sampleInterval, FramePool *framePool) {
+    /**
+        Opens the local decoder for the encoder output and the per-frame log
+        @param encodedParameters: codec parameters of the encoder output
+        @param timeBase: the encoder time base, packets and source frames are expected in it
+        @param logFileName: file receiving one line of metrics per measured frame
+        @param sampleInterval: measure every sampleInterval-th frame. Every packet is still decoded
+        @param framePool: pool the decoded frames come from, NULL for the default allocator
+        @returns 0 if successful, -1 if an error occured
+     */
+    this->sampleInterval = sampleInterval > 0 ? sampleInterval : 1;
+    AVCodec *codec = avcodec_find_decoder(encodedParameters->codec_id);
+    if(!codec) {
+        std::cout << "could not find a decoder for quality measurement! \n";
+        return -1;
+    }
+    decoderContext = avcodec_alloc_context3(codec);
+    decodedFrame = av_frame_alloc();
+    if(!decoderContext || !decodedFrame) {
+        std::cout << "could not allocate memory for quality measurement! \n";
+        return -1;
+    }
+    if(avcodec_parameters_to_context(decoderContext, encodedParameters) < 0) {
+        std::cout << "failed to fill the quality decoder context! \n";
+        return -1;
+    }
+    decoderContext->pkt_timebase = timeBase;
+    decoderContext->thread_count = 0; // let libavcodec pick, the decode should not hold back the encode
+    if(framePool) framePool->attach(decoderContext);
+    if(avcodec_open2(decoderContext, codec, NULL) < 0) {
+        std::cout << "failed to open the quality decoder! \n";
+        return -1;
+    }
+    logFile = fopen(logFileName.c_str(), "w");
+    if(!logFile) {
+        std::cout << "could not open quality log: " << logFileName << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+int QualityMonitor::addSourceFrame(const AVFrame *frame) {
+    /**
+        Keeps a reference to a source frame on the sampling schedule, to compare once its encoded version is decoded.
+        Call with frames in the encoder time base, right before they are sent to the encoder.
+     */
+    int64_t start = av_gettime_relative();
+    int ret = 0;
+    if(framesSeen++ % sampleInterval == 0 && frame->pts != AV_NOPTS_VALUE) {
+        AVFrame *source = av_frame_clone(frame);
+        if(!source) {
+            ret = -1;
+        } else {
+            av_frame_free(&sourceFrames[frame->pts]);
+            sourceFrames[frame->pts] = source;
+        }
+    }
+    microseconds += av_gettime_relative() - start;
+    return ret;
+}
+
+int QualityMonitor::addEncodedPacket(const AVPacket *packet) {
+    /**
+        Decodes a packet from the encoder, still in the encoder time base, and measures any sampled frames it completes
+     */
+    int64_t start = av_gettime_relative();
+    int ret = 0;
+    if(avcodec_send_packet(decoderContext, packet) < 0) {
+        std::cout << "Error while sending packet to quality decoder! \n";
+        ret = -1;
+    } else {
+        ret = receiveFrames();
+    }
+    microseconds += av_gettime_relative() - start;
+    return ret;
+}
+
+void QualityMonitor::addEncodeTime(int64_t encodeMicroseconds) {
+    /**
+        Adds time the measured stream spent encoding, which the measurement overhead is relative to
+     */
+    this->encodeMicroseconds += encodeMicroseconds;
+}
+
+int QualityMonitor::flush() {
+    /**
+        Drains the local decoder and writes the summary to the log.
+        If no frame could be measured the log says why instead of holding an empty summary.
+     */
+    int64_t start = av_gettime_relative();
+    int ret = 0;
+    if(avcodec_send_packet(decoderContext, NULL) == 0) ret = receiveFrames();
+    microseconds += av_gettime_relative() - start;
+    
+    QualityStats stats = getStats();
+    if(stats.framesMeasured == 0) {
+        std::string reason = framesSkipped > 0 ? skipReason : "no encoded frames were decoded";
+        std::cout << "quality could not be measured: " << reason << "\n";
+        fprintf(logFile, "summary unavailable frames:0 skipped:%llu reason:%s\n", (unsigned long long) framesSkipped, reason.c_str());
+        fflush(logFile);
+        return ret;
+    }
+    fprintf(logFile, "summary frames:%llu skipped:%llu psnr_y:%.2f psnr_u:%.2f psnr_v:%.2f psnr_avg:%.2f ssim_y:%.4f ssim_min:%.4f\n",
+            (unsigned long long) stats.framesMeasured, (unsigned long long) stats.framesSkipped,
+            stats.psnr[0], stats.psnr[1], stats.psnr[2], stats.psnrAverage, stats.ssim, stats.minSsim);
+    fflush(logFile);
+    return ret;
+}
+
+QualityStats QualityMonitor::getStats() {
+    QualityStats stats = {};
+    stats.framesMeasured = framesMeasured;
+    stats.framesSkipped = framesSkipped;
+    stats.microseconds = microseconds;
+    stats.encodeMicroseconds = encodeMicroseconds;
+    double squaredError = 0, samples = 0;
+    for(int plane = 0; plane < 3; plane++) {
+        stats.psnr[plane] = planeSamples[plane] > 0 ? psnrFromMse(squaredErrorTotal[plane] / planeSamples[plane]) : 0;
+        squaredError += squaredErrorTotal[plane];
+        samples += planeSamples[plane];
+    }
+    stats.psnrAverage = samples > 0 ? psnrFromMse(squaredError / samples) : 0;
+    stats.ssim = framesMeasured > 0 ? ssimTotal / framesMeasured : 0;
+    stats.minSsim = framesMeasured > 0 ? minSsim : 0;
+    return stats;
+}
+
+int64_t QualityMonitor::getMicroseconds() {
+    return microseconds;
+}
+
+int QualityMonitor::receiveFrames() {
+    int response = 0;
+    while(response >= 0) {
+        response = avcodec_receive_frame(decoderContext, decodedFrame);
+        if(response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+            break;
+        }
+        else if(response < 0) {
+            std::cout << "Error " << response << " when receiving frame from quality decoder " << av_err2str(response);
+            return -1;
+        }
+        std::map<int64_t, AVFrame*>::iterator source = sourceFrames.find(decodedFrame->best_effort_timestamp);
+        if(source != sourceFrames.end()) {
+            measure(source->second, decodedFrame);
+            av_frame_free(&source->second);
+            sourceFrames.erase(source);
+        }
+        av_frame_unref(decodedFrame);
+    }
+    return 0;
+}
+
+bool QualityMonitor::comparable(const AVFrame *source, const AVFrame *encoded, std::string &reason) {
+    /**
+        Checks that two frames have the same size and memory layout with 8 bit samples.
+        Formats that only differ in name, such as yuvj420p and yuv420p, are comparable.
+        @param reason: receives why the frames are not comparable
+     */
+    const AVPixFmtDescriptor *a = av_pix_fmt_desc_get((AVPixelFormat) source->format);
+    const AVPixFmtDescriptor *b = av_pix_fmt_desc_get((AVPixelFormat) encoded->format);
+    if(!a || !b) {
+        reason = "unknown pixel format";
+        return false;
+    }
+    if(source->width != encoded->width || source->height != encoded->height) {
+        reason = "the encoded frames have a different size";
+        return false;
+    }
+    bool sameLayout = a->nb_components == b->nb_components && a->log2_chroma_w == b->log2_chroma_w &&
+                      a->log2_chroma_h == b->log2_chroma_h && a->flags == b->flags;
+    for(int i = 0; sameLayout && i < a->nb_components; i++) {
+        sameLayout = a->comp[i].plane == b->comp[i].plane && a->comp[i].step == b->comp[i].step &&
+                     a->comp[i].offset == b->comp[i].offset && a->comp[i].depth == b->comp[i].depth;
+    }
+    if(!sameLayout) {
+        reason = std::string("source ") + a->name + " and encoded " + b->name + " differ in layout";
+        return false;
+    }
+    for(int i = 0; i < a->nb_components; i++) {
+        if(a->comp[i].depth != 8) {
+            reason = std::string("only 8 bit formats are measured, not ") + a->name;
+            return false;
+        }
+    }
+    return true;
+}
+
+void QualityMonitor::measure(const AVFrame *source, const AVFrame *encoded) {
+    /**
+        Computes PSNR of every plane and SSIM of the luma plane for one frame and logs them.
+        Frames that are not comparable are counted as skipped, the first one is reported.
+     */
+    std::string reason;
+    if(!comparable(source, encoded, reason)) {
+        if(framesSkipped++ == 0) {
+            skipReason = reason;
+            std::cout << "skipping quality measurement of frames: " << reason << "\n";
+        }
+        return;
+    }
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get((AVPixelFormat) source->format);
+    
+    double psnr[3] = {0, 0, 0};
+    int planes = FFMIN(av_pix_fmt_count_planes((AVPixelFormat) source->format), 3);
+    for(int plane = 0; plane < planes; plane++) {
+        int rowBytes = av_image_get_linesize((AVPixelFormat) source->format, source->width, plane);
+        int height = plane == 0 ? source->height : AV_CEIL_RSHIFT(source->height, descriptor->log2_chroma_h);
+        uint64_t squaredError = 0;
+        for(int y = 0; y < height; y++) {
+            squaredError += sumSquaredError(source->data[plane] + (ptrdiff_t) y * source->linesize[plane],
+                                            encoded->data[plane] + (ptrdiff_t) y * encoded->linesize[plane], rowBytes);
+        }
+        double samples = (double) rowBytes * height;
+        squaredErrorTotal[plane] += squaredError;
+        planeSamples[plane] += samples;
+        psnr[plane] = psnrFromMse(squaredError / samples);
+    }
+    double ssim = ssimPlane(source->data[0], source->linesize[0], encoded->data[0], encoded->linesize[0], source->width, source->height);
+    ssimTotal += ssim;
+    minSsim = FFMIN(minSsim, ssim);
+    framesMeasured++;
+    fprintf(logFile, "pts:%lld psnr_y:%.2f psnr_u:%.2f psnr_v:%.2f ssim_y:%.4f\n",
+            (long long) source->pts, psnr[0], psnr[1], psnr[2], ssim);
+}
+
+uint64_t QualityMonitor::sumSquaredError(const uint8_t *a, const uint8_t *b, int length) {
+    uint64_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    // widen to 16 bits and let pmaddwd square and pair up the differences.
+    // 32 bit lanes hold rows of up to 16k pixels
+    __m128i zero = _mm_setzero_si128();
+    __m128i accumulator = zero;
+    for(; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+        __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+        __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(low, low));
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(high, high));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, accumulator);
+    sum = (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for(; i < length; i++) {
+        int difference = a[i] - b[i];
+        sum += difference * difference;
+    }
+    return sum;
+}
+
+double QualityMonitor::ssimPlane(const uint8_t *a, int strideA, const uint8_t *b, int strideB, int width, int height) {
+    /**
+        Mean SSIM over 8x8 windows placed every 4 pixels, built from 4x4 block sums
+     */
+    int blocksWide = width / 4, blocksHigh = height / 4;
+    if(blocksWide < 2 || blocksHigh < 2) return 1;
+    std::vector<int64_t> sums((size_t) blocksWide * blocksHigh * 4);
+    for(int by = 0; by < blocksHigh; by++) {
+        for(int bx = 0; bx < blocksWide; bx++) {
+            ssimSums4x4(a + (ptrdiff_t) by * 4 * strideA + bx * 4, strideA,
+                        b + (ptrdiff_t) by * 4 * strideB + bx * 4, strideB,
+                        &sums[((size_t) by * blocksWide + bx) * 4]);
+        }
+    }
+    double total = 0;
+    for(int by = 0; by < blocksHigh - 1; by++) {
+        for(int bx = 0; bx < blocksWide - 1; bx++) {
+            int64_t window[4] = {0, 0, 0, 0};
+            const int64_t *blocks[4] = {
+                &sums[((size_t) by * blocksWide + bx) * 4], &sums[((size_t) by * blocksWide + bx + 1) * 4],
+                &sums[((size_t) (by + 1) * blocksWide + bx) * 4], &sums[((size_t) (by + 1) * blocksWide + bx + 1) * 4]
+            };
+            for(int block = 0; block < 4; block++) {
+                for(int k = 0; k < 4; k++) window[k] += blocks[block][k];
+            }
+            total += ssimWindow(window);
+        }
+    }
+    return total / ((double) (blocksWide - 1) * (blocksHigh - 1));
+}
@@ -0,0 +1,70 @@
+//
+//  qualitymetrics.hpp
+//  ffmpeg-experiments
+//
+//  Measures PSNR and SSIM of an encode while it runs, by decoding the encoder's
+//  packets with a local decoder and comparing them to the source frames.
+//
+#pragma once
+#ifndef qualitymetrics_hpp
+#define qualitymetrics_hpp
+
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include "framepool.hpp"
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/frame.h>
+}
+
+typedef struct QualityStats {
+    uint64_t framesMeasured;
+    double psnr[3]; // per plane, from the mean squared error over the measured frames
+    double psnrAverage;
+    double ssim; // mean luma SSIM
+    double minSsim;
+    uint64_t framesSkipped; // sampled frames that could not be compared with their source
+    int64_t microseconds; // time spent decoding and measuring
+    int64_t encodeMicroseconds; // time the measured stream spent encoding, without the measurement
+} QualityStats;
+
+class QualityMonitor {
+public:
+    QualityMonitor();
+    ~QualityMonitor();
+    int open(AVCodecParameters *encodedParameters, AVRational timeBase, const std::string &logFileName, int sampleInterval, FramePool *framePool);
+    int addSourceFrame(const AVFrame *frame);
+    int addEncodedPacket(const AVPacket *packet);
+    void addEncodeTime(int64_t encodeMicroseconds);
+    int flush();
+    QualityStats getStats();
+    int64_t getMicroseconds();
+    static double psnrFromMse(double mse);
+    static uint64_t sumSquaredError(const uint8_t *a, const uint8_t *b, int length);
+    static double ssimPlane(const uint8_t *a, int strideA, const uint8_t *b, int strideB, int width, int height);
+private:
+    AVCodecContext *decoderContext;
+    AVFrame *decodedFrame;
+    FILE *logFile;
+    std::map<int64_t, AVFrame*> sourceFrames; // sampled source frames by pts, until their encoded version is decoded
+    int sampleInterval;
+    uint64_t framesSeen;
+    double squaredErrorTotal[3];
+    double planeSamples[3];
+    double ssimTotal;
+    double minSsim;
+    uint64_t framesMeasured;
+    uint64_t framesSkipped;
+    std::string skipReason; // why the first skipped frame could not be measured
+    int64_t microseconds;
+    int64_t encodeMicroseconds;
+    int receiveFrames();
+    static bool comparable(const AVFrame *source, const AVFrame *encoded, std::string &reason);
+    void measure(const AVFrame *source, const AVFrame *encoded);
+};
+
+#endif /* qualitymetrics_hpp */
@@ -7,6 +7,19 @@
 
 #include "transcoder.hpp"
 #include <iostream>
+#include <sys/resource.h>
+
+extern "C" {
+    #include <libavutil/time.h>
+}
+
+static const int VARIABLE_AUDIO_FRAME_SIZE = 1024; // samples per frame for encoders that take any frame size
+
+static long pageFaults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
 
 int Transcoder::openMedia(const std::string &inputFileName, AVFormatContext **avfc){
     /**
@@ -31,6 +44,71 @@ int Transcoder::openMedia(const std::string &inputFileName, AVFormatContext **av
     return 0;
 }
 
+int Transcoder::openMedia(AVIOContext *avio, AVFormatContext **avfc){
+    /**
+            Opens media through a custom AVIOContext instead of a URL.
+            The AVIOContext is not owned by the format context and has to be freed by the caller.
+            @param avio an AVIOContext to read the media from
+            @param avfc an AVFormatContext for the media
+            @returns 0 if succesful, -1 if error occurs
+     */
+    *avfc = avformat_alloc_context();
+    if(!*avfc) {
+        std::cout << "failed to allocate memory for input format! \n";
+        return -1;
+    }
+    (*avfc)->pb = avio;
+    (*avfc)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    if(avformat_open_input(avfc, NULL, NULL, NULL) != 0){
+        std::cout << "failed to open input from custom IO \n";
+        return -1;
+    }
+    if(avformat_find_stream_info(*avfc, NULL) < 0){
+        std::cout << "failed to get stream information \n";
+        return -1;
+    }
+    return 0;
+}
+
+int Transcoder::openLiveMedia(LiveInput &input, LiveSource &source, AVFormatContext **avfc){
+    /**
+            Opens a live MPEG-TS input. The demuxer is not probed, and stream info is read with a small
+            probe size and analyze duration so the first packets come out quickly.
+            @param input the live input to open
+            @param source a LiveSource, which has to outlive the AVFormatContext
+            @param avfc an AVFormatContext for the input
+            @returns 0 if succesful, -1 if error occurs
+     */
+    std::string url;
+    AVDictionary *options = NULL;
+    if(source.open(input, url, &options) < 0) {
+        av_dict_free(&options);
+        return -1;
+    }
+    *avfc = avformat_alloc_context();
+    if(!*avfc) {
+        std::cout << "failed to allocate memory for input format! \n";
+        av_dict_free(&options);
+        return -1;
+    }
+    (*avfc)->probesize = input.probeSize > 0 ? input.probeSize : LiveSource::LIVE_PROBE_SIZE;
+    (*avfc)->max_analyze_duration = input.analyzeDuration > 0 ? input.analyzeDuration : LiveSource::LIVE_ANALYZE_DURATION;
+    (*avfc)->fps_probe_size = 5; // a few frames are enough to guess the frame rate
+    
+    AVInputFormat *mpegts = av_find_input_format("mpegts");
+    if(avformat_open_input(avfc, url.c_str(), mpegts, &options) != 0){
+        std::cout << "failed to open live input: " << input.url << "\n";
+        av_dict_free(&options);
+        return -1;
+    }
+    av_dict_free(&options);
+    if(avformat_find_stream_info(*avfc, NULL) < 0){
+        std::cout << "failed to get stream information \n";
+        return -1;
+    }
+    return 0;
+}
+
 int Transcoder::fillStreamInfo(AVStream *avStream, AVCodec **avCodec, AVCodecContext **avCodecContext){
     /**
         Fills a stream with correct information
@@ -56,6 +134,8 @@ int Transcoder::fillStreamInfo(AVStream *avStream, AVCodec **avCodec, AVCodecCon
         std::cout << "failed to fill the codec context! \n";
         return -1;
     }
+    (*avCodecContext)->pkt_timebase = avStream->time_base;
+    if(framePool) framePool->attach(*avCodecContext);
     if(avcodec_open2(*avCodecContext, *avCodec, NULL) < 0) {
         std::cout << "failed to open codec! \n";
         return -1;
@@ -63,147 +143,256 @@ int Transcoder::fillStreamInfo(AVStream *avStream, AVCodec **avCodec, AVCodecCon
     return 0;
 }
 
-int Transcoder::prepareDecoder(StreamContext *sc) {
+int Transcoder::prepareRoutes(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams) {
     /**
-            Prepares the decoder for an AVFormatContext
-            @param sc a StreamContext object
-            @returns 0 if successful, -1 if error occured
+        Builds the routing table, mapping every input stream to its handler.
+        Video and audio streams are transcoded or copied depending on streamParams,
+        subtitles are copied if the output container supports them, everything else is dropped.
+        @param decoder: StreamContext for the opened input
+        @param encoder: StreamContext for the output
+        @param streamParams: a StreamParams object containing codec settings
+        @returns 0 if successful, -1 if error occured
      */
-    // iterate over streams, we only keep audio and video in this case
-    for(int i = 0; i < sc->avFormatContext->nb_streams; i++){
-        if(sc->avFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO){
-            sc->videoAVStream = sc->avFormatContext->streams[i];
-            sc->videoIndex = i;
-            
-            if(fillStreamInfo(sc->videoAVStream, &sc->videoAVCodec, &sc->videoAVCodecContext) < 0) {
+    routes.assign(decoder->avFormatContext->nb_streams, StreamRoute());
+    bool measuringQuality = false;
+    for(unsigned int i = 0; i < decoder->avFormatContext->nb_streams; i++){
+        AVStream *stream = decoder->avFormatContext->streams[i];
+        StreamRoute *route = &routes[i];
+        route->handler = &Transcoder::dropStream;
+        route->inputStream = stream;
+        route->decoderTimeBase = stream->time_base;
+        
+        AVMediaType type = stream->codecpar->codec_type;
+        if(type == AVMEDIA_TYPE_VIDEO && (stream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            std::cout << "Stream " << i << " is cover art, skipping \n";
+        }
+        else if((type == AVMEDIA_TYPE_VIDEO && streamParams.copyVideo) ||
+                (type == AVMEDIA_TYPE_AUDIO && streamParams.copyAudio)) {
+            if(prepareCopy(encoder->avFormatContext, &route->outputStream, stream->codecpar) < 0) {
                 return -1;
             }
+            route->handler = &Transcoder::copyStream;
         }
-        else if(sc->avFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO){
-            sc->audioAVStream = sc->avFormatContext->streams[i];
-            
-            if(fillStreamInfo(sc->audioAVStream, &sc->audioAVCodec, &sc->audioAVCodecContext) <0) {
+        else if(type == AVMEDIA_TYPE_VIDEO) {
+            AVCodec *decoderCodec = NULL;
+            if(fillStreamInfo(stream, &decoderCodec, &route->decoderContext) < 0) {
+                return -1;
+            }
+            AVRational inputFrameRate = av_guess_frame_rate(decoder->avFormatContext, stream, NULL);
+            if(inputFrameRate.num <= 0 || inputFrameRate.den <= 0) {
+                std::cout << "Stream " << i << " has no known frame rate, assuming 25 fps \n";
+                inputFrameRate = (AVRational){25, 1};
+            }
+            if(prepareVideoEncoder(encoder->avFormatContext, route, inputFrameRate, streamParams) < 0) {
+                return -1;
+            }
+            if(streamParams.dropDuplicateFrames) {
+                route->deduplicator = new FrameDeduplicator(streamParams.duplicateThreshold);
+            }
+            if(!streamParams.qualityLogFile.empty() && !measuringQuality) {
+                route->qualityMonitor = new QualityMonitor();
+                if(route->qualityMonitor->open(route->outputStream->codecpar, route->encoderTimeBase, streamParams.qualityLogFile, streamParams.qualitySampleInterval, framePool) < 0) {
+                    return -1;
+                }
+                measuringQuality = true;
+            }
+            route->handler = &Transcoder::transcodeStream;
+        }
+        else if(type == AVMEDIA_TYPE_AUDIO) {
+            AVCodec *decoderCodec = NULL;
+            if(fillStreamInfo(stream, &decoderCodec, &route->decoderContext) < 0) {
+                return -1;
+            }
+            if(prepareAudioEncoder(encoder->avFormatContext, route, streamParams) < 0) {
+                return -1;
+            }
+            route->handler = &Transcoder::transcodeStream;
+        }
+        else if(type == AVMEDIA_TYPE_SUBTITLE) {
+            // muxers without a codec list, such as mpegts, answer with an error rather than 1,
+            // only skip what is known to be unsupported and let the header write reject the rest
+            if(avformat_query_codec(encoder->avFormatContext->oformat, stream->codecpar->codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+                std::cout << "Stream " << i << " has subtitles the output format does not support, skipping \n";
+                continue;
+            }
+            if(prepareCopy(encoder->avFormatContext, &route->outputStream, stream->codecpar) < 0) {
                 return -1;
             }
+            route->handler = &Transcoder::copyStream;
         }
         else {
-            std::cout << "Stream " << i << " is neither audio nor video, skipping \n";
+            std::cout << "Stream " << i << " is neither audio, video nor subtitles, skipping \n";
+        }
+        // keep language and title tags so multi-language tracks stay identifiable
+        if(route->outputStream) {
+            av_dict_copy(&route->outputStream->metadata, stream->metadata, 0);
+            route->outputStream->disposition = stream->disposition;
         }
     }
     return 0;
 }
 
-int Transcoder::prepareVideoEncoder(StreamContext *streamContext, AVCodecContext *decoderContext, AVRational &inputFrameRate, StreamParams &streamParams){
+int Transcoder::prepareVideoEncoder(AVFormatContext *outputContext, StreamRoute *route, AVRational &inputFrameRate, StreamParams &streamParams){
     /**
-        Prepares a video encoder. The method creates a stream, AVCodec, and AVCodecContext.
-        These are kept in the input StreamContext.
+        Prepares a video encoder. The method creates a stream and an AVCodecContext,
+        which are kept in the StreamRoute.
         The resulting avCodec will copy video height, width, sample aspect ratio, and sometimes pixel format
-        from the input AVCodecContext.
-        @param streamContext: A StreamContext that will contain the encoding data
-        @param decoderContext: The input AVCodecContext
+        from the decoder of the route.
+        @param outputContext: The output AVFormatContext
+        @param route: A StreamRoute with an opened decoder
         @param inputFramerate: the framerate of the input file
         @param streamParams: a StreamParams object containing codec settings
      
      */
+    AVCodecContext *decoderContext = route->decoderContext;
     // create a stream
-    streamContext->videoAVStream = avformat_new_stream(streamContext->avFormatContext, NULL);
+    route->outputStream = avformat_new_stream(outputContext, NULL);
     // setup encoder
-    streamContext->videoAVCodec = avcodec_find_encoder_by_name(streamParams.videoCodec.c_str());
-    if(!streamContext->videoAVCodec) {
+    AVCodec *videoAVCodec = avcodec_find_encoder_by_name(streamParams.videoCodec.c_str());
+    if(!videoAVCodec) {
         std::cout << "could not find the proper codec! \n";
         return -1;
     }
     
     // setup codec context for video
-    streamContext->videoAVCodecContext = avcodec_alloc_context3(streamContext->videoAVCodec);
-    if(!streamContext->videoAVCodecContext) {
+    route->encoderContext = avcodec_alloc_context3(videoAVCodec);
+    if(!route->encoderContext) {
         std::cout << "could not allocate memory for codec context! \n";
         return -1;
     }
+    AVCodecContext *encoderContext = route->encoderContext;
     
-//    av_opt_set(streamContext->videoAVCodecContext->priv_data, "preset", "fast", 0); // TODO: make this configurable
+//    av_opt_set(encoderContext->priv_data, "preset", "fast", 0); // TODO: make this configurable
     if(streamParams.codecPrivKey.c_str() && streamParams.codecPrivValue.c_str()) {
-        av_opt_set(streamContext->videoAVCodecContext->priv_data, streamParams.codecPrivKey.c_str(), streamParams.codecPrivValue.c_str(), 0);
+        av_opt_set(encoderContext->priv_data, streamParams.codecPrivKey.c_str(), streamParams.codecPrivValue.c_str(), 0);
     }
     
     // copy height, width, aspect ratio
-    streamContext->videoAVCodecContext->height = decoderContext->height;
-    streamContext->videoAVCodecContext->width = decoderContext->width;
-    streamContext->videoAVCodecContext->sample_aspect_ratio = decoderContext->sample_aspect_ratio;
+    encoderContext->height = decoderContext->height;
+    encoderContext->width = decoderContext->width;
+    encoderContext->sample_aspect_ratio = decoderContext->sample_aspect_ratio;
     
     // copy pixel format. TODO: make this configurable by user!
-    if(streamContext->videoAVCodec->pix_fmts) {
-        streamContext->videoAVCodecContext->pix_fmt = streamContext->videoAVCodec->pix_fmts[0];
+    if(videoAVCodec->pix_fmts) {
+        encoderContext->pix_fmt = videoAVCodec->pix_fmts[0];
     } else {
-        streamContext->videoAVCodecContext->pix_fmt = decoderContext->pix_fmt;
+        encoderContext->pix_fmt = decoderContext->pix_fmt;
     }
     
-    streamContext->videoAVCodecContext->bit_rate = 3 * 1000 * 1000; // Default to 3Mbit/s
-    streamContext->videoAVCodecContext->rc_buffer_size = 6 * 1000 * 1000 + 2 * 100 * 1000;
-    streamContext->videoAVCodecContext->rc_max_rate = 4.7 * 1000 * 1000;
-    streamContext->videoAVCodecContext->rc_min_rate = 3 * 1000 * 1000;
+    encoderContext->bit_rate = 3 * 1000 * 1000; // Default to 3Mbit/s
+    encoderContext->rc_buffer_size = 6 * 1000 * 1000 + 2 * 100 * 1000;
+    encoderContext->rc_max_rate = 4.7 * 1000 * 1000;
+    encoderContext->rc_min_rate = 3 * 1000 * 1000;
     
     // setup time base (use input frame rate for this)
-    streamContext->videoAVCodecContext->time_base = av_inv_q(inputFrameRate);
-    streamContext->videoAVStream->time_base = streamContext->videoAVCodecContext->time_base;
+    encoderContext->time_base = av_inv_q(inputFrameRate);
+    encoderContext->framerate = inputFrameRate;
+    route->outputStream->time_base = encoderContext->time_base;
+    route->encoderTimeBase = encoderContext->time_base;
+    
+    if(outputContext->oformat->flags & AVFMT_GLOBALHEADER) {
+        encoderContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
     
-    if(avcodec_open2(streamContext->videoAVCodecContext, streamContext->videoAVCodec, NULL) < 0) {
+    if(avcodec_open2(encoderContext, videoAVCodec, NULL) < 0) {
         std::cout <<  "could not open the codec! \n";
         return -1;
     }
-    avcodec_parameters_from_context(streamContext->videoAVStream->codecpar, streamContext->videoAVCodecContext);
+    avcodec_parameters_from_context(route->outputStream->codecpar, encoderContext);
     return 0;
 }
 
-int Transcoder::prepareAudioEncoder(StreamContext *streamContext, int &sampleRate, StreamParams &streamParams){
-    streamContext->audioAVStream = avformat_new_stream(streamContext->avFormatContext, NULL);
+int Transcoder::prepareAudioEncoder(AVFormatContext *outputContext, StreamRoute *route, StreamParams &streamParams){
+    route->outputStream = avformat_new_stream(outputContext, NULL);
     
-    streamContext->audioAVCodec = avcodec_find_encoder_by_name(streamParams.audioCodec.c_str());
-    if(!streamContext->audioAVCodec) {
+    AVCodec *audioAVCodec = avcodec_find_encoder_by_name(streamParams.audioCodec.c_str());
+    if(!audioAVCodec) {
         std::cout << "Could not find the correct audio codec! \n";
         return -1;
     }
-    streamContext->audioAVCodecContext = avcodec_alloc_context3(streamContext->audioAVCodec);
-    if(!streamContext->audioAVCodecContext) {
+    route->encoderContext = avcodec_alloc_context3(audioAVCodec);
+    if(!route->encoderContext) {
         std::cout << "could not allocate memory for audio codec context! \n";
         return -1;
     }
+    AVCodecContext *encoderContext = route->encoderContext;
+    int sampleRate = route->decoderContext->sample_rate;
     
     int OUTPUT_CHANNELS = 2; // only stereo audio for now, maybe we add configurable channels down the line ?
     int OUTPUT_BIT_RATE = 196000; // default to 196kbps, make this configurable later!
     
     // configure our codec context
-    streamContext->audioAVCodecContext->channels = OUTPUT_CHANNELS;
-    streamContext->audioAVCodecContext->channel_layout = av_get_default_channel_layout(OUTPUT_CHANNELS);
-    streamContext->audioAVCodecContext->sample_rate = sampleRate;
-    streamContext->audioAVCodecContext->sample_fmt = streamContext->audioAVCodec->sample_fmts[0];
-    streamContext->audioAVCodecContext->bit_rate = OUTPUT_BIT_RATE;
-    streamContext->audioAVCodecContext->time_base = (AVRational){1, sampleRate};
+    encoderContext->channels = OUTPUT_CHANNELS;
+    encoderContext->channel_layout = av_get_default_channel_layout(OUTPUT_CHANNELS);
+    encoderContext->sample_rate = sampleRate;
+    encoderContext->sample_fmt = audioAVCodec->sample_fmts[0];
+    encoderContext->bit_rate = OUTPUT_BIT_RATE;
+    encoderContext->time_base = (AVRational){1, sampleRate};
+    
+    encoderContext->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
     
-    streamContext->audioAVCodecContext->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    route->outputStream->time_base = encoderContext->time_base; //match time bases
+    route->encoderTimeBase = encoderContext->time_base;
     
-    streamContext->audioAVStream->time_base = streamContext->audioAVCodecContext->time_base; //match time bases
+    if(outputContext->oformat->flags & AVFMT_GLOBALHEADER) {
+        encoderContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
     
-    if(avcodec_open2(streamContext->audioAVCodecContext, streamContext->audioAVCodec, NULL) < 0) {
+    if(avcodec_open2(encoderContext, audioAVCodec, NULL) < 0) {
         std::cout << "Could not open the codec! \n";
         return -1;
     }
     
     // set the codec parameters based on our context params
-    avcodec_parameters_from_context(streamContext->audioAVStream->codecpar, streamContext->audioAVCodecContext);
+    avcodec_parameters_from_context(route->outputStream->codecpar, encoderContext);
     
+    route->audioFifo = av_audio_fifo_alloc(encoderContext->sample_fmt, encoderContext->channels, FFMAX(encoderContext->frame_size, VARIABLE_AUDIO_FRAME_SIZE));
+    if(!route->audioFifo) {
+        std::cout << "could not allocate audio FIFO! \n";
+        return -1;
+    }
+    route->nextAudioPts = AV_NOPTS_VALUE;
+    return 0;
+}
+
+int Transcoder::prepareResampler(StreamRoute *route, AVFrame *frame) {
+    /**
+        Sets up the conversion from decoded audio to the layout, sample format and rate of the encoder.
+        It is configured from the first decoded frame, since not every decoder reports its format when opened.
+        @param route: A StreamRoute with an opened audio encoder
+        @param frame: the first decoded frame
+        @returns 0 if succesful, -1 otherwise
+     */
+    AVCodecContext *encoderContext = route->encoderContext;
+    // some decoders only report the channel count
+    int64_t inputLayout = frame->channel_layout ? (int64_t) frame->channel_layout : av_get_default_channel_layout(frame->channels);
+    route->resampler = swr_alloc_set_opts(NULL,
+                                          encoderContext->channel_layout, encoderContext->sample_fmt, encoderContext->sample_rate,
+                                          inputLayout, (AVSampleFormat) frame->format, frame->sample_rate,
+                                          0, NULL);
+    if(!route->resampler || swr_init(route->resampler) < 0) {
+        std::cout << "could not set up the audio resampler! \n";
+        return -1;
+    }
     return 0;
 }
 
-int Transcoder::remux(AVPacket **packet, AVFormatContext **formatContext, AVRational decoderTb, AVRational encoderTb){
+int Transcoder::copyStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame){
     /**
-        Remuxes a packet
+        Remuxes a packet into the output stream of its route
      */
-    av_packet_rescale_ts(*packet,decoderTb, encoderTb);
-    if(av_interleaved_write_frame(*formatContext, *packet) < 0) {
+    av_packet_rescale_ts(inputPacket, route->decoderTimeBase, route->outputTimeBase);
+    inputPacket->stream_index = route->outputStream->index;
+    inputPacket->pos = -1;
+    if(av_interleaved_write_frame(outputContext, inputPacket) < 0) {
         std::cout << "Failed to copy frame! \n";
         return -1;
     }
+    if(latencyTracker) latencyTracker->packetMuxed(route->outputStream->index, AV_NOPTS_VALUE);
+    return 0;
+}
+
+int Transcoder::dropStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame) {
     return 0;
 }
 
@@ -212,20 +401,24 @@ int Transcoder::prepareCopy(AVFormatContext *avFormatContext, AVStream **avStrea
         Bootstraps settings for copying a stream
      */
     *avStream = avformat_new_stream(avFormatContext, NULL);
+    if(!*avStream) {
+        std::cout << "Failed to allocate memory for output stream! \n";
+        return -1;
+    }
     avcodec_parameters_copy((*avStream)->codecpar, decoderParameters);
     return 0;
 }
 
-int Transcoder::encodeVideo(StreamContext *decoderContext, StreamContext *encoderContext, AVFrame *inputFrame) {
+int Transcoder::encodeFrame(StreamRoute *route, AVFormatContext *outputContext, AVFrame *inputFrame) {
     /**
-         Encodes a video  AVFrame to the encoder StreamContext.
-         Copies the stream index and time base from the decoder StreamContext
-         @param decoderContext: StreamContext for the decoder (i.e input)
-         @param encoderContext: StreamContext for the encoder (i.e output)
-         @param inputFrame: The frame to encode
+         Encodes an AVFrame with the encoder of the route and writes the packets to its output stream.
+         @param route: the StreamRoute the frame belongs to
+         @param outputContext: The output AVFormatContext
+         @param inputFrame: The frame to encode, in the encoder time base. NULL flushes the encoder
          @returns 0 if succesful, -1 otherwise
      */
-    if(inputFrame) inputFrame->pict_type = AV_PICTURE_TYPE_NONE; //reset frame type to let the encoder do whatever
+    bool isVideo = route->encoderContext->codec_type == AVMEDIA_TYPE_VIDEO;
+    if(inputFrame && isVideo) inputFrame->pict_type = AV_PICTURE_TYPE_NONE; //reset frame type to let the encoder do whatever
     // allocate memory for output packet
     AVPacket *outPacket = av_packet_alloc();
     if(!outPacket) {
@@ -233,12 +426,21 @@ int Transcoder::encodeVideo(StreamContext *decoderContext, StreamContext *encode
         return -1;
     }
     
-    // send raw video frame to encoder
-    int response = avcodec_send_frame(encoderContext->videoAVCodecContext, inputFrame);
+    bool timed = route->deduplicator || route->qualityMonitor;
+    int64_t encodeStart = timed ? av_gettime_relative() : 0;
+    int64_t qualityStart = route->qualityMonitor ? route->qualityMonitor->getMicroseconds() : 0;
+    if(inputFrame && route->qualityMonitor && route->qualityMonitor->addSourceFrame(inputFrame) < 0) {
+        std::cout << "could not keep source frame for quality measurement! \n";
+        av_packet_free(&outPacket);
+        return -1;
+    }
+    if(inputFrame && isVideo && latencyTracker) latencyTracker->frameSent(route->outputStream->index, inputFrame->pts);
+    // send raw frame to encoder
+    int response = avcodec_send_frame(route->encoderContext, inputFrame);
     // response will be 0 as long as everything is OK, we use this to loop
     while (response >= 0) {
         // receive the encoded packet
-        response = avcodec_receive_packet(encoderContext->videoAVCodecContext, outPacket);
+        response = avcodec_receive_packet(route->encoderContext, outPacket);
         if(response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
             // we're done with the file, exit loop
             break;
@@ -246,66 +448,141 @@ int Transcoder::encodeVideo(StreamContext *decoderContext, StreamContext *encode
         else if (response < 0) {
             // some other error occured
             std::cout << "Error when receiving packet from encoder! \n" << av_err2str(response) << "\n";
+            av_packet_free(&outPacket);
             return -1;
         }
         
-        // set time base and duration
-        outPacket->stream_index = decoderContext->videoIndex;
-        outPacket->duration = encoderContext->videoAVStream->time_base.den / encoderContext->videoAVStream->time_base.num / decoderContext->videoAVStream->avg_frame_rate.num * decoderContext->videoAVStream->avg_frame_rate.den;
+        outPacket->stream_index = route->outputStream->index;
+        // kept frames last until the next kept frame, otherwise the video encoder ticks once per frame
+        if(route->deduplicator) outPacket->duration = route->deduplicator->packetDuration(outPacket->pts);
+        else if(isVideo && outPacket->duration == 0) outPacket->duration = 1;
+        if(route->qualityMonitor && route->qualityMonitor->addEncodedPacket(outPacket) < 0) {
+            av_packet_free(&outPacket);
+            return -1;
+        }
+        int64_t encoderPts = outPacket->pts;
         // convert to output time base
-        av_packet_rescale_ts(outPacket, decoderContext->videoAVStream->time_base, encoderContext->videoAVStream->time_base);
-        response = av_interleaved_write_frame(encoderContext->avFormatContext, outPacket);
+        av_packet_rescale_ts(outPacket, route->encoderTimeBase, route->outputTimeBase);
+        response = av_interleaved_write_frame(outputContext, outPacket);
         if (response != 0) {
-            std::cout << "Error " << response << " when receiving packet from decoder! " << av_err2str(response) << "\n";
+            std::cout << "Error " << response << " when writing packet! " << av_err2str(response) << "\n";
+            av_packet_free(&outPacket);
             return -1;
         }
+        if(latencyTracker) latencyTracker->packetMuxed(route->outputStream->index, isVideo ? encoderPts : AV_NOPTS_VALUE);
        
     }
     // deref and free
     av_packet_unref(outPacket);
     av_packet_free(&outPacket);
     
+    if(timed) {
+        // quality measurement runs inside the loop, keep it out of the encode time
+        int64_t qualityTime = route->qualityMonitor ? route->qualityMonitor->getMicroseconds() - qualityStart : 0;
+        int64_t encodeTime = av_gettime_relative() - encodeStart - qualityTime;
+        if(route->deduplicator) {
+            dedupStats.encodeMicroseconds += encodeTime;
+            if(inputFrame) dedupStats.framesEncoded++;
+        }
+        if(route->qualityMonitor) route->qualityMonitor->addEncodeTime(encodeTime);
+    }
     return 0;
 }
 
-int Transcoder::transcodeVideo(StreamContext *decoderContext, StreamContext *encoderContext, AVPacket *inputPacket, AVFrame *inputFrame) {
-    // send the raw data to the decoder
-    int response = avcodec_send_packet(decoderContext->videoAVCodecContext, inputPacket);
-    if (response < 0) {
-        std::cout << "Error while sending packet to decoder! \n";
-        return response;
+int Transcoder::resampleFrame(StreamRoute *route, AVFrame *inputFrame) {
+    /**
+        Converts a decoded audio frame and adds the samples to the FIFO of the route.
+        NULL drains the samples the resampler still holds.
+     */
+    AVCodecContext *encoderContext = route->encoderContext;
+    int inputSamples = inputFrame ? inputFrame->nb_samples : 0;
+    int outputSamples = swr_get_out_samples(route->resampler, inputSamples);
+    if(outputSamples <= 0) return outputSamples;
+    uint8_t **converted = NULL;
+    if(av_samples_alloc_array_and_samples(&converted, NULL, encoderContext->channels, outputSamples, encoderContext->sample_fmt, 0) < 0) {
+        std::cout << "could not allocate memory for converted samples! \n";
+        return -1;
     }
-    while(response >= 0) {
-        // read the decoded frame
-        response = avcodec_receive_frame(decoderContext->videoAVCodecContext, inputFrame);
-        if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
-            // no more to read,end loop
-            break;
+    int samples = swr_convert(route->resampler, converted, outputSamples,
+                              inputFrame ? (const uint8_t**) inputFrame->extended_data : NULL, inputSamples);
+    int ret = samples >= 0 && av_audio_fifo_write(route->audioFifo, (void**) converted, samples) >= samples ? 0 : -1;
+    av_freep(&converted[0]);
+    av_freep(&converted);
+    if(ret < 0) std::cout << "could not convert audio samples! \n";
+    return ret;
+}
+
+int Transcoder::encodeAudioFrame(StreamRoute *route, AVFormatContext *outputContext, AVFrame *inputFrame) {
+    /**
+         Resamples a decoded audio frame and encodes the buffered samples in frames of the encoder frame size,
+         so tracks with any layout, sample format or frame size can be encoded.
+         @param inputFrame: The frame to encode, in the encoder time base. NULL encodes the remaining samples
+         @returns 0 if succesful, -1 otherwise
+     */
+    AVCodecContext *encoderContext = route->encoderContext;
+    if(inputFrame) {
+        if(!route->resampler && prepareResampler(route, inputFrame) < 0) return -1;
+        // later timestamps follow from the sample count, which keeps the output free of gaps
+        if(route->nextAudioPts == AV_NOPTS_VALUE) route->nextAudioPts = inputFrame->pts == AV_NOPTS_VALUE ? 0 : inputFrame->pts;
+    }
+    if(route->resampler && resampleFrame(route, inputFrame) < 0) return -1;
+    
+    bool variableFrameSize = encoderContext->frame_size == 0 || (encoderContext->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE);
+    bool smallLastFrame = variableFrameSize || (encoderContext->codec->capabilities & AV_CODEC_CAP_SMALL_LAST_FRAME);
+    int frameSize = variableFrameSize ? VARIABLE_AUDIO_FRAME_SIZE : encoderContext->frame_size;
+    int available;
+    while((available = av_audio_fifo_size(route->audioFifo)) >= frameSize || (!inputFrame && available > 0)) {
+        int samples = FFMIN(available, frameSize);
+        AVFrame *frame = av_frame_alloc();
+        if(!frame) {
+            std::cout << "could not allocate memory for audio frame! \n";
+            return -1;
         }
-        else if (response < 0) {
-            std::cout << "Error " << response << " when receiving frame from decoder " << av_err2str(response);
-            return response;
+        frame->nb_samples = smallLastFrame ? samples : frameSize;
+        frame->format = encoderContext->sample_fmt;
+        frame->channel_layout = encoderContext->channel_layout;
+        frame->channels = encoderContext->channels;
+        frame->sample_rate = encoderContext->sample_rate;
+        if(av_frame_get_buffer(frame, 0) < 0 || av_audio_fifo_read(route->audioFifo, (void**) frame->extended_data, samples) < samples) {
+            std::cout << "could not read samples from the audio FIFO! \n";
+            av_frame_free(&frame);
+            return -1;
         }
-        
-        if (response >= 0) {
-            // frame was read correctly, encode it
-            if(encodeVideo(decoderContext, encoderContext, inputFrame) < 0) return -1;
+        // encoders without small last frame support get the tail padded with silence
+        if(frame->nb_samples > samples) {
+            av_samples_set_silence(frame->extended_data, samples, frame->nb_samples - samples, frame->channels, (AVSampleFormat) frame->format);
         }
-        // unref the frame
-        av_frame_unref(inputFrame);
+        frame->pts = route->nextAudioPts;
+        route->nextAudioPts += frame->nb_samples;
+        int ret = encodeFrame(route, outputContext, frame);
+        av_frame_free(&frame);
+        if(ret < 0) return -1;
     }
     return 0;
 }
 
-int Transcoder::transcodeAudio(StreamContext *decoderContext, StreamContext *encoderContext, AVPacket *inputPacket, AVFrame *inputFrame) {
-    int response = avcodec_send_packet(decoderContext->audioAVCodecContext, inputPacket);
-    if (response < 0 ) {
+int Transcoder::transcodeStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame) {
+    /**
+        Decodes a packet with the decoder of the route and encodes the resulting frames.
+        A NULL inputPacket drains the decoder.
+     */
+    bool isVideo = route->decoderContext->codec_type == AVMEDIA_TYPE_VIDEO;
+    int64_t decodeStart = av_gettime_relative();
+    // page faults are only counted inside the decode calls, encoder allocations would drown them out
+    long faultsStart = isVideo ? pageFaults() : 0;
+    // send the raw data to the decoder
+    int response = avcodec_send_packet(route->decoderContext, inputPacket);
+    if (response < 0) {
         std::cout << "Error while sending packet to decoder! \n";
         return response;
     }
     while(response >= 0) {
-        // read the decoded frame(s)
-        response = avcodec_receive_frame(decoderContext->audioAVCodecContext, inputFrame);
+        // read the decoded frame
+        response = avcodec_receive_frame(route->decoderContext, inputFrame);
+        if(isVideo) {
+            decodeStats.decodeMicroseconds += av_gettime_relative() - decodeStart;
+            decodeStats.pageFaults += pageFaults() - faultsStart;
+        }
         if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
             // no more to read,end loop
             break;
@@ -314,78 +591,52 @@ int Transcoder::transcodeAudio(StreamContext *decoderContext, StreamContext *enc
             std::cout << "Error " << response << " when receiving frame from decoder " << av_err2str(response);
             return response;
         }
-        if (response >= 0) {
-            if (encodeAudio(decoderContext,encoderContext,inputFrame) < 0) return -1;
-        }
+        if(isVideo) decodeStats.framesDecoded++;
         
+        // frame was read correctly, move it to the encoder time base and encode it
+        if(inputFrame->best_effort_timestamp != AV_NOPTS_VALUE) {
+            inputFrame->pts = av_rescale_q(inputFrame->best_effort_timestamp, route->decoderTimeBase, route->encoderTimeBase);
+        }
+        AVFrame *frame = inputFrame;
+        if(route->deduplicator) {
+            dedupStats.framesIn++;
+            // dropped frames extend the previous kept one, which is encoded once its duration is known
+            if(route->deduplicator->isDuplicate(inputFrame)) {
+                dedupStats.framesDropped++;
+                frame = NULL;
+            } else {
+                frame = route->deduplicator->hold(inputFrame);
+            }
+        }
+        if(frame && (isVideo ? encodeFrame(route, outputContext, frame) : encodeAudioFrame(route, outputContext, frame)) < 0) return -1;
+        // unref the frame
         av_frame_unref(inputFrame);
+        decodeStart = av_gettime_relative();
+        if(isVideo) faultsStart = pageFaults();
     }
     return 0;
-
 }
 
-int Transcoder::encodeAudio(StreamContext *decoderContext, StreamContext *encoderContext, AVFrame *inputFrame){
+int Transcoder::flushStream(StreamRoute *route, AVFormatContext *outputContext, AVFrame *frame) {
     /**
-        Encodes an audio AVFrame to the encoder StreamContext.
-        Copies the stream index and time base from the decoder StreamContext
-        @param decoderContext: StreamContext for the decoder (i.e input)
-        @param encoderContext: StreamContext for the encoder (i.e output)
-        @param inputFrame: The frame to encode
-        @returns 0 if succesful, -1 otherwise
+        Drains the decoder and encoder of a transcoded route
      */
-    AVPacket *outPacket = av_packet_alloc();
-    if(!outPacket) {
-        std::cout << "could not allocate memory for output packet!! \n";
-        return -1;
-    }
-    
-    int response = avcodec_send_frame(encoderContext->audioAVCodecContext, inputFrame);
-    while(response >= 0) {
-        response = avcodec_receive_packet(encoderContext->audioAVCodecContext, outPacket);
-        if(response == AVERROR(EAGAIN) || response == AVERROR_EOF){
-            break;
-        } else if (response != 0) {
-            std::cout << "Error " << response << " when receiving packet from decoder! " << av_err2str(response) << "\n";
-            return -1;
-        }
-        outPacket->stream_index = decoderContext->audioIndex;
-        av_packet_rescale_ts(outPacket, decoderContext->audioAVCodecContext->time_base, encoderContext->audioAVCodecContext->time_base);
-        response = av_interleaved_write_frame(encoderContext->avFormatContext, outPacket);
-        if (response != 0){
-            std::cout << "Error " << response << " while receiving packet from decoder: " << av_err2str(response) << "\n";
-            return -1;
-        }
-    }
-    // unref and free memory
-    av_packet_unref(outPacket);
-    av_packet_free(&outPacket);
+    if(transcodeStream(route, outputContext, NULL, frame) < 0) return -1;
+    AVFrame *lastKept = route->deduplicator ? route->deduplicator->release() : NULL;
+    if(lastKept && encodeFrame(route, outputContext, lastKept) < 0) return -1;
+    if(route->audioFifo && encodeAudioFrame(route, outputContext, NULL) < 0) return -1;
+    if(encodeFrame(route, outputContext, NULL) < 0) return -1;
+    if(route->qualityMonitor) return route->qualityMonitor->flush();
     return 0;
-    
 }
 
-
-
 int Transcoder::Transcode(std::string &inputFile, std::string &outputFile,StreamParams &streamParams) {
     /**
         Transcodes a video file and writes the result to an output file.
         @param inputFile: the URL of the file to transcode (i.e input file)
         @param outputFile: the URL of the output file (the transcoded file)
-        @param codec: the name of codec library (for example: "libx264")
-        @param codecPrivKey: the key for the codec settings (example: "x264-params")
-        @param codecPrivValue: the codec settings (example: "keyint=123:min-keyint:23")
-        @param copyAudio: if true, the audio is simply transmuxed and not transcoded
-        @param copyVideo: same as copyAudio, but for the video stream
+        @param streamParams: a StreamParams object containing codec settings
      */
-    
-    // init our streamparams
-    // maybe pass this as an argument instead, and init somewhere else?
-//    StreamParams streamParams = {};
-//    streamParams.copyAudio = copyAudio;
-//    streamParams.copyVideo = copyVideo;
-//    streamParams.videoCodec = codec;
-//    streamParams.codecPrivKey = codecPrivkey;
-//    streamParams.codecPrivValue = codecPrivValue;
-//    
     // init StreamContexts for encoder and decoder
     StreamContext *decoder = (StreamContext*) calloc(1, sizeof(StreamContext));
     decoder->fileName = inputFile;
@@ -393,49 +644,138 @@ int Transcoder::Transcode(std::string &inputFile, std::string &outputFile,Stream
     StreamContext *encoder = (StreamContext*) calloc(1, sizeof(StreamContext));
     encoder->fileName = outputFile;
     
-    if(openMedia(decoder->fileName, &decoder->avFormatContext) < 0) return -1;
-    if(prepareDecoder(decoder) <0 ) return  -1;
+    int ret = -1;
+    if(openMedia(decoder->fileName, &decoder->avFormatContext) == 0) {
+        ret = transcodeToFile(decoder, encoder, streamParams);
+    }
+    cleanUp(decoder, encoder);
+    return ret;
+}
+
+int Transcoder::TranscodeLive(LiveInput &input, std::string &outputFile, StreamParams &streamParams) {
+    /**
+        Transcodes a live MPEG-TS input and writes the result to an output file.
+        Packets are flushed to the output as they are muxed. The input ends at EOF or once
+        no data has arrived for input.readTimeout.
+        Time to the first output packet and encode-to-mux latency are available from getLatencyStats afterwards.
+        @param input: the live input, stdin, a FIFO or a local UDP socket
+        @param outputFile: the URL of the output file (the transcoded file)
+        @param streamParams: a StreamParams object containing codec settings. For low latency
+            pass encoder options such as x265's zerolatency tune through codecPrivKey and codecPrivValue
+     */
+    LatencyTracker tracker;
+    latencyTracker = &tracker;
+    
+    StreamContext *decoder = (StreamContext*) calloc(1, sizeof(StreamContext));
+    decoder->fileName = input.url;
     
+    StreamContext *encoder = (StreamContext*) calloc(1, sizeof(StreamContext));
+    encoder->fileName = outputFile;
+    
+    // declared before the contexts are opened so it is destroyed after cleanUp closes them
+    LiveSource source;
+    int ret = -1;
+    if(openLiveMedia(input, source, &decoder->avFormatContext) == 0) {
+        ret = transcodeToFile(decoder, encoder, streamParams);
+    }
+    cleanUp(decoder, encoder);
+    latencyStats = tracker.getStats();
+    latencyTracker = NULL;
+    return ret;
+}
+
+int Transcoder::transcodeToFile(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams) {
+    /**
+        Opens the output file of the encoder StreamContext and transcodes the opened input into it
+        @returns 0 if succesful, -1 otherwise
+     */
     // alloc output context for our new file
     avformat_alloc_output_context2(&encoder->avFormatContext, NULL, NULL, encoder->fileName.c_str());
-    // check that context was created correctly
     if(!encoder->avFormatContext) {
         std::cout << "Could not allocate memory for the output format! \n";
         return -1;
     }
-    
-    if(!streamParams.copyVideo) {
-        AVRational inputFrameRate = av_guess_frame_rate(decoder->avFormatContext, decoder->videoAVStream, NULL);
-        prepareVideoEncoder(encoder, decoder->videoAVCodecContext, inputFrameRate,streamParams);
+    if(latencyTracker) {
+        // hand every packet to the output right away
+        encoder->avFormatContext->flags |= AVFMT_FLAG_FLUSH_PACKETS;
     }
-    else {
-        if(prepareCopy(encoder->avFormatContext, &encoder->videoAVStream, decoder->videoAVStream->codecpar) < 0) { //try to prepare for copying
-            return -1;
-        }
+    if(!(encoder->avFormatContext->oformat->flags & AVFMT_NOFILE) &&
+       avio_open(&encoder->avFormatContext->pb, encoder->fileName.c_str(), AVIO_FLAG_WRITE) < 0) {
+        std::cout << "could not open the output file! \n";
+        return -1;
     }
-    
-    if(!streamParams.copyAudio) {
-        // TODO: set up audio encoder
-        if(prepareAudioEncoder(encoder, decoder->audioAVCodecContext->sample_rate, streamParams) < 0) {
-            return -1;
-        }
-    } else {
-        //TODO: set up copy
-        if(prepareCopy(encoder->avFormatContext, &encoder->audioAVStream, decoder->audioAVStream->codecpar)) {
-            return -1;
-        }
+    int ret = transcodeStreams(decoder, encoder, streamParams);
+    if(!(encoder->avFormatContext->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&encoder->avFormatContext->pb);
     }
+    return ret;
+}
+
+int Transcoder::Transcode(MediaSource &input, MediaSink &output, StreamParams &streamParams) {
+    /**
+        Transcodes media read from a MediaSource and writes the result to a MediaSink,
+        without touching the filesystem.
+        @param input: the source to read the input media from
+        @param output: the sink to write the transcoded media to
+        @param streamParams: a StreamParams object containing codec settings.
+            outputExtenstion selects the output container (for example: "mkv"), since there is no file name to guess it from
+     */
+    StreamContext *decoder = (StreamContext*) calloc(1, sizeof(StreamContext));
+    StreamContext *encoder = (StreamContext*) calloc(1, sizeof(StreamContext));
+    // only used by the muxer to guess the container format
+    encoder->fileName = "output." + streamParams.outputExtenstion;
     
-    if(encoder->avFormatContext->oformat->flags & AVFMT_GLOBALHEADER) {
-        encoder->avFormatContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    }
+    AVIOContext *inputIO = MediaIO::openSource(input);
+    AVIOContext *outputIO = MediaIO::openSink(output);
     
-    if(!(encoder->avFormatContext->oformat->flags & AVFMT_NOFILE)){
-        if(avio_open(&encoder->avFormatContext->pb, encoder->fileName.c_str(), AVIO_FLAG_WRITE ) < 0){
-            std::cout << "could not open the output file! \n";
-            return -1;
+    int ret = -1;
+    if(inputIO && outputIO && openMedia(inputIO, &decoder->avFormatContext) == 0) {
+        avformat_alloc_output_context2(&encoder->avFormatContext, NULL, NULL, encoder->fileName.c_str());
+        if(!encoder->avFormatContext) {
+            std::cout << "Could not allocate memory for the output format! \n";
+        } else {
+            encoder->avFormatContext->pb = outputIO;
+            encoder->avFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+            ret = transcodeStreams(decoder, encoder, streamParams);
         }
     }
+    cleanUp(decoder, encoder);
+    MediaIO::close(&inputIO);
+    MediaIO::close(&outputIO);
+    return ret;
+}
+
+int Transcoder::Transcode(const uint8_t *inputData, size_t inputSize, std::vector<uint8_t> &outputData, StreamParams &streamParams) {
+    /**
+        Transcodes media held in memory into a growable output buffer.
+        @param inputData: the input media, it is not copied
+        @param inputSize: the size of inputData in bytes
+        @param outputData: receives the transcoded media
+        @param streamParams: a StreamParams object containing codec settings, outputExtenstion selects the container
+     */
+    MemoryInput memoryInput = {inputData, inputSize, 0};
+    MemoryOutput memoryOutput = {&outputData, 0};
+    outputData.clear();
+    MediaSource source = MediaIO::memorySource(&memoryInput);
+    MediaSink sink = MediaIO::memorySink(&memoryOutput);
+    return Transcode(source, sink, streamParams);
+}
+
+int Transcoder::transcodeStreams(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams) {
+    /**
+        Sets up the decoders and encoders and runs the transcode loop.
+        Expects the input to be opened and the output AVFormatContext to be allocated with a writable pb.
+        @param decoder: StreamContext for the opened input
+        @param encoder: StreamContext for the output
+        @param streamParams: a StreamParams object containing codec settings
+        @returns 0 if succesful, -1 otherwise
+     */
+    dedupStats = DedupStats();
+    decodeStats = DecodeStats();
+    if(streamParams.pooledFrameBuffers) {
+        framePool = new FramePool(streamParams.hugePageFrameBuffers);
+    }
+    if(prepareRoutes(decoder, encoder, streamParams) < 0) return -1;
     
     AVDictionary* muxerOptions = NULL;
     // we use c_str() for easier evaluation
@@ -447,6 +787,10 @@ int Transcoder::Transcode(std::string &inputFile, std::string &outputFile,Stream
         std::cout << "An error occured when opening the output file! \n";
         return -1;
     }
+    // the muxer may have changed the output time bases when writing the header
+    for(size_t i = 0; i < routes.size(); i++) {
+        if(routes[i].outputStream) routes[i].outputTimeBase = routes[i].outputStream->time_base;
+    }
     
     // allocate memory for frames and packets
     AVFrame *inFrame = av_frame_alloc();
@@ -462,43 +806,55 @@ int Transcoder::Transcode(std::string &inputFile, std::string &outputFile,Stream
     }
     // read the input file. av_read_frame returns zero if OK,
     // < 0 if an error occured or it has reached EOF.
-    while(av_read_frame(decoder->avFormatContext, inPacket) >= 0) {
-        // TODO: set up transcoding or muxing here!
-        // I cant find a way to hot-swap in C++, so we'll do it the ugly way
-        if(decoder->avFormatContext->streams[inPacket->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO){
-            if(!streamParams.copyVideo) {
-                if (transcodeVideo(decoder, encoder, inPacket, inFrame) < 0) {
-                    return -1;
-                }
-                av_packet_unref(inPacket);
-            } else {
-                if(remux(&inPacket, &encoder->avFormatContext, decoder->videoAVStream->time_base, encoder->videoAVStream->time_base) < 0) {
-                    return -1;
-                }
-            }
-        } else if (decoder->avFormatContext->streams[inPacket->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO){
-            if(!streamParams.copyAudio) {
-                if (transcodeAudio(decoder, encoder, inPacket, inFrame) < 0) {
-                    return -1;
-                }
-                av_packet_unref(inPacket);
-            } else {
-                if(remux(&inPacket, &encoder->avFormatContext, decoder->videoAVStream->time_base, encoder->videoAVStream->time_base) < 0) {
-                    return -1;
-                }
-            }
-        } else {
-            std::cout << "ignoring non video/audio packages \n";
+    int readResult;
+    while((readResult = av_read_frame(decoder->avFormatContext, inPacket)) >= 0) {
+        // streams that show up after the header was written have no route
+        if(inPacket->stream_index >= (int) routes.size()) {
+            av_packet_unref(inPacket);
+            continue;
+        }
+        StreamRoute *route = &routes[inPacket->stream_index];
+        if((this->*route->handler)(route, encoder->avFormatContext, inPacket, inFrame) < 0) {
+            return -1;
         }
+        av_packet_unref(inPacket);
     }
     
-    // flush video encoder
-    if(encodeVideo(decoder, encoder, NULL) < 0) {
-        return -1;
+    if(readResult != AVERROR_EOF) {
+        std::cout << "input ended: " << av_err2str(readResult) << "\n";
+    }
+    
+    // flush decoders and encoders
+    for(size_t i = 0; i < routes.size(); i++) {
+        if(routes[i].handler == &Transcoder::transcodeStream && flushStream(&routes[i], encoder->avFormatContext, inFrame) < 0) {
+            return -1;
+        }
     }
     
     av_write_trailer(encoder->avFormatContext);
     
+    if(decodeStats.decodeMicroseconds > 0) {
+        std::cout << "decoded " << decodeStats.framesDecoded << " frames at " << decodeStats.framesDecoded * 1000000.0 / decodeStats.decodeMicroseconds
+                  << " fps with the " << (framePool ? "pooled" : "default") << " allocator, " << decodeStats.pageFaults << " page faults while decoding \n";
+    }
+    if(streamParams.dropDuplicateFrames && dedupStats.framesEncoded > 0) {
+        double savedSeconds = (double) dedupStats.encodeMicroseconds / dedupStats.framesEncoded * dedupStats.framesDropped / 1000000;
+        std::cout << "dropped " << dedupStats.framesDropped << " of " << dedupStats.framesIn << " duplicate frames, saving about " << savedSeconds << "s of encoding \n";
+    }
+    if(latencyTracker) {
+        LatencyStats latency = latencyTracker->getStats();
+        std::cout << "first output packet after " << latency.timeToFirstPacket / 1000 << "ms, steady state encode-to-mux latency "
+                  << latency.meanLatency / 1000 << "ms (max " << latency.maxLatency / 1000 << "ms) \n";
+    }
+    for(size_t i = 0; i < routes.size(); i++) {
+        if(!routes[i].qualityMonitor) continue;
+        QualityStats quality = routes[i].qualityMonitor->getStats();
+        if(quality.framesMeasured == 0) continue; // flushStream already reported why
+        double overhead = quality.encodeMicroseconds > 0 ? 100.0 * quality.microseconds / quality.encodeMicroseconds : 0;
+        std::cout << "measured " << quality.framesMeasured << " frames: PSNR " << quality.psnrAverage << " dB, SSIM " << quality.ssim
+                  << ", overhead " << overhead << "% of encode time \n";
+    }
+    
     // free memory
     if(muxerOptions != NULL) {
         av_dict_free(&muxerOptions);
@@ -514,15 +870,51 @@ int Transcoder::Transcode(std::string &inputFile, std::string &outputFile,Stream
         av_packet_free(&inPacket);
         inPacket = NULL;
     }
-    
+    return 0;
+}
+
+DedupStats Transcoder::getDedupStats() {
+    /**
+        Frame deduplication statistics of the last transcode
+     */
+    return dedupStats;
+}
+
+DecodeStats Transcoder::getDecodeStats() {
+    /**
+        Decode speed and page faults of the last transcode
+     */
+    return decodeStats;
+}
+
+LatencyStats Transcoder::getLatencyStats() {
+    /**
+        Latency statistics of the last live transcode
+     */
+    return latencyStats;
+}
+
+void Transcoder::cleanUp(StreamContext *decoder, StreamContext *encoder) {
+    /**
+        Frees the contexts used when transcoding, including the StreamContexts themselves.
+        Custom AVIOContexts are left to the caller.
+     */
     avformat_close_input(&decoder->avFormatContext);
-    avformat_free_context(decoder->avFormatContext); decoder->avFormatContext = NULL;
     avformat_free_context(encoder->avFormatContext); encoder->avFormatContext = NULL;
-    avcodec_free_context(&decoder->videoAVCodecContext); decoder->videoAVCodecContext = NULL;
-    avcodec_free_context(&decoder->audioAVCodecContext); decoder->audioAVCodecContext = NULL;
+    for(size_t i = 0; i < routes.size(); i++) {
+        avcodec_free_context(&routes[i].decoderContext);
+        avcodec_free_context(&routes[i].encoderContext);
+        delete routes[i].deduplicator;
+        delete routes[i].qualityMonitor;
+        swr_free(&routes[i].resampler);
+        av_audio_fifo_free(routes[i].audioFifo);
+    }
+    routes.clear();
+    // after the decoders, which may still hold pooled frames
+    delete framePool;
+    framePool = NULL;
     free(decoder);
     decoder = NULL;
     free(encoder);
     encoder = NULL;
-    return 0;
 }
@@ -9,6 +9,13 @@
 #define transcoder_h
 
 #include <string>
+#include <vector>
+#include "mediaio.hpp"
+#include "framededup.hpp"
+#include "qualitymetrics.hpp"
+#include "liveinput.hpp"
+#include "latency.hpp"
+#include "framepool.hpp"
 
 #define __STDC_CONSTANT_MACROS
 extern "C" {
@@ -16,6 +23,8 @@ extern "C" {
     #include <libavformat/avformat.h>
     #include <libavcodec/avcodec.h>
     #include <libavutil/opt.h>
+    #include <libavutil/audio_fifo.h>
+    #include <libswresample/swresample.h>
 }
 typedef struct StreamParams {
     bool copyVideo;
@@ -27,38 +36,77 @@ typedef struct StreamParams {
     std::string audioCodec;
     std::string codecPrivKey;
     std::string codecPrivValue;
+    bool dropDuplicateFrames; // drop near-identical video frames, making the output variable frame rate
+    double duplicateThreshold; // mean absolute luma difference of any 16x16 block still counted as a duplicate, 0 only drops exact copies
+    std::string qualityLogFile; // per-frame PSNR/SSIM of the video encode are written here, empty disables measuring
+    int qualitySampleInterval; // measure every n-th frame, 0 or 1 measures all of them
+    bool pooledFrameBuffers; // decode into per-job pools of aligned buffers instead of the default allocator
+    bool hugePageFrameBuffers; // back large pooled buffers with transparent huge pages
 } StreamParams;
 
 typedef struct StreamContext {
     AVFormatContext *avFormatContext;
-    AVCodec *videoAVCodec;
-    AVCodec *audioAVCodec;
-    AVStream *videoAVStream;
-    AVStream *audioAVStream;
-    AVCodecContext *videoAVCodecContext;
-    AVCodecContext *audioAVCodecContext;
-    int videoIndex;
-    int audioIndex;
     std::string fileName;
 } StreamContext;
 
+class Transcoder;
+struct StreamRoute;
+// handles a packet of one input stream: transcodeStream, copyStream or dropStream
+typedef int (Transcoder::*StreamHandler)(StreamRoute *route, AVFormatContext *outputContext, AVPacket *packet, AVFrame *frame);
+
+typedef struct StreamRoute {
+    StreamHandler handler;
+    AVStream *inputStream;
+    AVStream *outputStream; // NULL if the stream is dropped
+    AVCodecContext *decoderContext; // only set when transcoding
+    AVCodecContext *encoderContext;
+    AVRational decoderTimeBase; // time base of the input stream
+    AVRational encoderTimeBase;
+    AVRational outputTimeBase; // only known after the header is written, muxers may change it
+    FrameDeduplicator *deduplicator; // only set for transcoded video when dropping duplicates
+    QualityMonitor *qualityMonitor; // only set for the first transcoded video stream when measuring quality
+    SwrContext *resampler; // converts decoded audio to the encoder layout, format and rate, set up on the first frame
+    AVAudioFifo *audioFifo; // converted samples, until there are enough for an encoder frame
+    int64_t nextAudioPts; // in the encoder time base, counts the samples sent to the encoder
+} StreamRoute;
+
 class Transcoder {
 public:
     std::string inputCodec;
     std::string outputCodec;
     int Transcode(std::string &inputFile, std::string &outputFile,StreamParams &streamParams);
+    int Transcode(MediaSource &input, MediaSink &output, StreamParams &streamParams);
+    int Transcode(const uint8_t *inputData, size_t inputSize, std::vector<uint8_t> &outputData, StreamParams &streamParams);
+    int TranscodeLive(LiveInput &input, std::string &outputFile, StreamParams &streamParams);
+    DedupStats getDedupStats();
+    LatencyStats getLatencyStats();
+    DecodeStats getDecodeStats();
 private:
+    std::vector<StreamRoute> routes; // indexed by input stream index
+    DedupStats dedupStats = {}; // of the last transcode
+    LatencyTracker *latencyTracker = NULL; // only set while transcoding live input
+    LatencyStats latencyStats = {}; // of the last live transcode
+    FramePool *framePool = NULL; // only set while transcoding with pooled frame buffers
+    DecodeStats decodeStats = {}; // of the last transcode
     int openMedia(const std::string &inputFileName, AVFormatContext **avfc);
-    int prepareDecoder(StreamContext *sc); // TODO: refactor signature for consistency
+    int openMedia(AVIOContext *avio, AVFormatContext **avfc);
+    int openLiveMedia(LiveInput &input, LiveSource &source, AVFormatContext **avfc);
     int fillStreamInfo(AVStream *avStream, AVCodec **avCodec, AVCodecContext **avCodecContext);
-    int prepareVideoEncoder(StreamContext *streamContext, AVCodecContext *decoderContext, AVRational &inputFrameRate, StreamParams &streamParams);
-    int prepareAudioEncoder(StreamContext *streamContext, int &sampleRate, StreamParams &streamParams);
+    int prepareRoutes(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams);
+    int prepareVideoEncoder(AVFormatContext *outputContext, StreamRoute *route, AVRational &inputFrameRate, StreamParams &streamParams);
+    int prepareAudioEncoder(AVFormatContext *outputContext, StreamRoute *route, StreamParams &streamParams);
+    int prepareResampler(StreamRoute *route, AVFrame *frame);
     int prepareCopy(AVFormatContext *avFormatContext, AVStream **avStream, AVCodecParameters *decoderParameters);
-    int remux(AVPacket **packet, AVFormatContext **formatContext, AVRational decoderTb, AVRational encoderTb);
-    int encodeVideo(StreamContext *decoderContext, StreamContext *encoderContext, AVFrame *inputFrame);
-    int encodeAudio(StreamContext *decoderContext, StreamContext *encoderContext, AVFrame *inputFrame);
-    int transcodeVideo(StreamContext *decoderContext, StreamContext *encoderContext, AVPacket *inputPacket, AVFrame *inputFrame);
-    int transcodeAudio(StreamContext *decoderContext, StreamContext *encoderContext, AVPacket *inputPacket, AVFrame *inputFrame);
+    int transcodeStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame);
+    int copyStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame);
+    int dropStream(StreamRoute *route, AVFormatContext *outputContext, AVPacket *inputPacket, AVFrame *inputFrame);
+    int encodeFrame(StreamRoute *route, AVFormatContext *outputContext, AVFrame *inputFrame);
+    int encodeAudioFrame(StreamRoute *route, AVFormatContext *outputContext, AVFrame *inputFrame);
+    int resampleFrame(StreamRoute *route, AVFrame *inputFrame);
+    int flushStream(StreamRoute *route, AVFormatContext *outputContext, AVFrame *frame);
+    int transcodeStreams(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams);
+    int transcodeToFile(StreamContext *decoder, StreamContext *encoder, StreamParams &streamParams);
+    void cleanUp(StreamContext *decoder, StreamContext *encoder);
     
 };
 
@@ -8,11 +8,7 @@
 #include "transmuxer.hpp"
 
 int Transmuxer::transmux(std::string &inputFileName, std::string &outputFileName) {
-    AVPacket packet;
-    
-        int ret, i;
-        int streamIndex = 0;
-        int numStreams = 0;
+        int ret;
         int *streamsList = NULL;
         
         // attempt to open the input file
@@ -21,14 +17,67 @@ int Transmuxer::transmux(std::string &inputFileName, std::string &outputFileName
             return cleanUp(streamsList,ret);
         };
         
+        // allocate an AVContext for the output
+        avformat_alloc_output_context2(&outputFormatContext, NULL, NULL, outputFileName.c_str());
+        return copyStreams(outputFileName);
+}
+
+int Transmuxer::transmux(MediaSource &input, MediaSink &output, std::string &outputExtension) {
+    /**
+        Transmuxes media read from a MediaSource to a MediaSink, without touching the filesystem.
+        @param outputExtension: selects the output container (for example: "mkv")
+     */
+        int ret;
+        int *streamsList = NULL;
+        std::string outputName = "output." + outputExtension; // only used to guess the container format
+        
+        AVIOContext *inputIO = MediaIO::openSource(input);
+        AVIOContext *outputIO = MediaIO::openSink(output);
+        if(!inputIO || !outputIO) {
+            MediaIO::close(&inputIO);
+            MediaIO::close(&outputIO);
+            ret = AVERROR(ENOMEM);
+            return cleanUp(streamsList, ret);
+        }
+        
+        inputFormatContext = avformat_alloc_context();
+        if(inputFormatContext) {
+            inputFormatContext->pb = inputIO;
+            inputFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+        if(( ret = avformat_open_input(&inputFormatContext, NULL, NULL, NULL)) < 0) {
+            std::cout << "Could not open input!";
+            ret = cleanUp(streamsList, ret);
+        } else {
+            avformat_alloc_output_context2(&outputFormatContext, NULL, NULL, outputName.c_str());
+            if(outputFormatContext) {
+                outputFormatContext->pb = outputIO;
+                outputFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+            }
+            ret = copyStreams(outputName);
+        }
+        MediaIO::close(&inputIO);
+        MediaIO::close(&outputIO);
+        return ret;
+}
+
+int Transmuxer::copyStreams(const std::string &outputFileName) {
+    /**
+        Copies every audio, video and subtitle stream from the opened input to the allocated output
+     */
+    AVPacket packet;
+    
+        int ret;
+        int streamIndex = 0;
+        int numStreams = 0;
+        int *streamsList = NULL;
+        
         // attempt finding stream info in input file
         if((ret = avformat_find_stream_info(inputFormatContext, NULL)) < 0) {
             std::cout << "Failed to retrieve input stream info!";
             return cleanUp(streamsList, ret);
             
         }
-        // allocate an AVContext for the output
-        avformat_alloc_output_context2(&outputFormatContext, NULL, NULL, outputFileName.c_str());
         if(!outputFormatContext){ //null check for output context
             std::cout << "Failed to allocate memory for output context!";
             ret = AVERROR_UNKNOWN;
@@ -74,11 +123,11 @@ int Transmuxer::transmux(std::string &inputFileName, std::string &outputFileName
         // TODO: Complete method
         
         // set up write buffer for output file
-        if(!(outputFormatContext->oformat->flags & AVFMT_NOFILE)){
+        if(!(outputFormatContext->oformat->flags & AVFMT_NOFILE) && !outputFormatContext->pb){
             ret = avio_open(&outputFormatContext->pb, outputFileName.c_str(),AVIO_FLAG_WRITE);
             if(ret < 0){
                 std::cout << "Could not open output file: " << outputFileName;
-                cleanUp(streamsList, ret);
+                return cleanUp(streamsList, ret);
             }
         }
     
@@ -88,7 +137,7 @@ int Transmuxer::transmux(std::string &inputFileName, std::string &outputFileName
     ret = avformat_write_header(outputFormatContext, &opts);
     if (ret < 0) {
         std::cout << "Error occured when opening output file! \n";
-        cleanUp(streamsList, ret);
+        return cleanUp(streamsList, ret);
     }
     
     // here we start to copy the packets
@@ -143,10 +192,13 @@ int Transmuxer::cleanUp(int* streamList, int &ret) {
     // close input context
     avformat_close_input(&inputFormatContext);
     // TODO: complete method
-    if(!outputFormatContext && !(outputFormatContext->oformat->flags & AVFMT_NOFILE)) {
+    // custom IO contexts belong to the caller
+    if(outputFormatContext && !(outputFormatContext->oformat->flags & AVFMT_NOFILE) &&
+       !(outputFormatContext->flags & AVFMT_FLAG_CUSTOM_IO)) {
         avio_closep(&outputFormatContext->pb);
     }
     avformat_free_context(outputFormatContext);
+    outputFormatContext = NULL;
     av_freep(&streamList);
     if(ret < 0 && ret != AVERROR_EOF){
         std::cout << "An error occured: \n";
@@ -9,6 +9,7 @@
 #define transmuxer_hpp
 #include <string>
 #include <iostream>
+#include "mediaio.hpp"
 #define __STDC_CONSTANT_MACROS
 extern "C" {
     #include <libavutil/timestamp.h>
@@ -18,9 +19,11 @@ extern "C" {
 class Transmuxer {
 public:
     int transmux (std::string &inputFileName, std::string &outputFileName);
+    int transmux (MediaSource &input, MediaSink &output, std::string &outputExtension);
 private:
     AVFormatContext* inputFormatContext = NULL;
     AVFormatContext* outputFormatContext = NULL;
+    int copyStreams(const std::string &outputFileName);
     int cleanUp(int* streamList, int &ret);
 };
 
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <yaml-cpp/yaml.h>
+#include <sys/stat.h>
 #include "AV/src/transmuxer.hpp"
 #include "AV/src/transcoder.hpp"
 
@@ -17,8 +18,19 @@ int main(int argc, char* argv[]) {
     streamParams.videoCodec = std::string("libx265");
     streamParams.codecPrivKey = std::string("x265-params");
     streamParams.codecPrivValue = std::string("keyint=60:min-keyint=60:scenecut=0");
-    std::string output = "transcoded" + input;
-    int response = transcoder.Transcode(input, output, streamParams);
+    int response;
+    struct stat inputInfo;
+    bool fifo = stat(input.c_str(), &inputInfo) == 0 && S_ISFIFO(inputInfo.st_mode);
+    if(input == "-" || fifo || input.compare(0, 6, "udp://") == 0) {
+        // live MPEG-TS from stdin, a named pipe or a local UDP socket
+        LiveInput liveInput = {};
+        liveInput.url = input;
+        std::string output = "transcoded-live.ts";
+        response = transcoder.TranscodeLive(liveInput, output, streamParams);
+    } else {
+        std::string output = "transcoded" + input;
+        response = transcoder.Transcode(input, output, streamParams);
+    }
     //std::cout << "Builds and runs! \n";
     return response; 
 }
@@ -0,0 +1,109 @@
+//
+//  dedup_test.cpp
+//  ffmpeg-experiments
+//
+//  Transcodes a generated slide show with duplicate frame dropping and checks the
+//  dedup statistics and the output timeline: the static frames are dropped, a small cursor
+//  appearing is kept, and the kept frames last until the next one.
+//
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include "transcoder.hpp"
+#include "syntheticclip.hpp"
+
+static const int FRAMES = 50;
+static const int CURSOR_FRAME = 25; // first frame showing the cursor
+
+static void paintSlide(AVFrame *frame, int index, void *opaque) {
+    /**
+        A static slide, with an 8x8 cursor from CURSOR_FRAME on. The cursor changes
+        well under one luma level on average over the frame.
+     */
+    for(int y = 0; y < frame->height; y++) {
+        for(int x = 0; x < frame->width; x++) {
+            bool cursor = index >= CURSOR_FRAME && x >= 160 && x < 168 && y >= 120 && y < 128;
+            frame->data[0][y * frame->linesize[0] + x] = cursor ? 235 : (uint8_t) (16 + (x / 40) * 20);
+        }
+    }
+    for(int y = 0; y < frame->height / 2; y++) {
+        for(int x = 0; x < frame->width / 2; x++) {
+            frame->data[1][y * frame->linesize[1] + x] = 128;
+            frame->data[2][y * frame->linesize[2] + x] = 128;
+        }
+    }
+}
+
+static int checkTimeline(std::string &outputFile) {
+    /**
+        The output holds only the kept frames, at pts 0 and CURSOR_FRAME, and still lasts all FRAMES frames
+     */
+    AVFormatContext *format = NULL;
+    if(avformat_open_input(&format, outputFile.c_str(), NULL, NULL) != 0 || avformat_find_stream_info(format, NULL) < 0) {
+        std::cout << "could not open " << outputFile << "\n";
+        avformat_close_input(&format);
+        return -1;
+    }
+    AVRational frameTimeBase = {1, 25};
+    std::vector<int64_t> keptFrames;
+    AVPacket *packet = av_packet_alloc();
+    while(packet && av_read_frame(format, packet) >= 0) {
+        AVStream *stream = format->streams[packet->stream_index];
+        if(stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            keptFrames.push_back(av_rescale_q(packet->pts, stream->time_base, frameTimeBase));
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    int64_t durationFrames = av_rescale_q(format->duration, (AVRational){1, AV_TIME_BASE}, frameTimeBase);
+    avformat_close_input(&format);
+    
+    if(keptFrames.size() != 2 || keptFrames[0] != 0 || keptFrames[1] != CURSOR_FRAME || durationFrames != FRAMES) {
+        std::cout << "output has " << keptFrames.size() << " frames lasting " << durationFrames << " frames, expected frames 0 and "
+                  << CURSOR_FRAME << " lasting " << FRAMES << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+static int check(Transcoder &transcoder, std::string &inputFile, std::string &outputFile, double threshold) {
+    StreamParams streamParams = {};
+    streamParams.copyAudio = true;
+    streamParams.videoCodec = "mpeg4";
+    streamParams.outputExtenstion = "mkv";
+    streamParams.dropDuplicateFrames = true;
+    streamParams.duplicateThreshold = threshold;
+    if(transcoder.Transcode(inputFile, outputFile, streamParams) < 0) return -1;
+    int timeline = checkTimeline(outputFile);
+    unlink(outputFile.c_str());
+    if(timeline < 0) return -1;
+    
+    DedupStats stats = transcoder.getDedupStats();
+    // only the first frame and the first frame with the cursor are kept
+    uint64_t expectedDropped = FRAMES - 2;
+    if(stats.framesIn != (uint64_t) FRAMES || stats.framesDropped != expectedDropped) {
+        std::cout << "threshold " << threshold << ": " << stats.framesIn << " frames in, " << stats.framesDropped
+                  << " dropped, expected " << FRAMES << " in, " << expectedDropped << " dropped \n";
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::ostringstream prefix;
+    prefix << "/tmp/dedup-test-" << getpid();
+    // lossless, so the static frames decode bit-identical
+    std::string inputFile = prefix.str() + "-slides.mkv";
+    std::string outputFile = prefix.str() + "-out.mkv";
+    if(writeSyntheticClip(inputFile, "ffv1", 320, 240, FRAMES, paintSlide, NULL) < 0) return 1;
+    
+    Transcoder transcoder = Transcoder();
+    int failed = 0;
+    if(check(transcoder, inputFile, outputFile, 0) < 0) failed = 1;
+    if(check(transcoder, inputFile, outputFile, 4) < 0) failed = 1;
+    unlink(inputFile.c_str());
+    std::cout << (failed ? "dedup test failed \n" : "dedup test passed \n");
+    return failed;
+}
@@ -0,0 +1,130 @@
+//
+//  live_test.cpp
+//  ffmpeg-experiments
+//
+//  Feeds a generated MPEG-TS stream to TranscodeLive through a FIFO and over local UDP,
+//  from a writer thread pacing it like a live source. Checks that output packets come out,
+//  that the first one is timed, and that the read timeout ends the job while the FIFO
+//  writer is still connected.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "transcoder.hpp"
+#include "syntheticclip.hpp"
+
+extern "C" {
+    #include <libavutil/time.h>
+}
+
+static const int CHUNK_SIZE = 7 * 188; // the usual TS payload of a UDP datagram
+static const int64_t READ_TIMEOUT = 500 * 1000;
+static const int WRITER_HOLD_MILLISECONDS = 3000; // the FIFO writer stays connected this long after the last chunk
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string &what) {
+    if(!condition) {
+        std::cout << "failed: " << what << "\n";
+        failures++;
+    }
+}
+
+static void writeFifo(const std::string &path, const std::vector<uint8_t> *stream) {
+    // blocks until TranscodeLive opens the reading end
+    int fd = open(path.c_str(), O_WRONLY);
+    if(fd < 0) return;
+    for(size_t offset = 0; offset < stream->size(); offset += CHUNK_SIZE) {
+        size_t length = std::min((size_t) CHUNK_SIZE, stream->size() - offset);
+        if(write(fd, stream->data() + offset, length) != (ssize_t) length) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // a stalled feed rather than a closed one, only the read timeout can end the job
+    std::this_thread::sleep_for(std::chrono::milliseconds(WRITER_HOLD_MILLISECONDS));
+    close(fd);
+}
+
+static void writeUdp(int port, const std::vector<uint8_t> *stream) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) return;
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // give TranscodeLive time to bind, datagrams sent before that are lost
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    for(size_t offset = 0; offset < stream->size(); offset += CHUNK_SIZE) {
+        size_t length = std::min((size_t) CHUNK_SIZE, stream->size() - offset);
+        sendto(sock, stream->data() + offset, length, 0, (struct sockaddr*) &address, sizeof(address));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    close(sock);
+}
+
+static void checkLive(Transcoder &transcoder, LiveInput &input, std::string &outputFile, const std::string &name, int64_t maxMicroseconds) {
+    StreamParams streamParams = {};
+    streamParams.copyAudio = true;
+    streamParams.videoCodec = "mpeg4";
+    streamParams.outputExtenstion = "ts";
+    
+    int64_t start = av_gettime_relative();
+    int ret = transcoder.TranscodeLive(input, outputFile, streamParams);
+    int64_t elapsed = av_gettime_relative() - start;
+    LatencyStats latency = transcoder.getLatencyStats();
+    struct stat output;
+    expect(ret == 0, name + ": live transcode succeeds");
+    expect(latency.timeToFirstPacket > 0, name + ": time to first packet is measured");
+    expect(stat(outputFile.c_str(), &output) == 0 && output.st_size > 0, name + ": output is written");
+    expect(elapsed < maxMicroseconds, name + ": the read timeout ends the job");
+    unlink(outputFile.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN); // a reader giving up early must fail the test, not kill it
+    std::ostringstream prefix;
+    prefix << "/tmp/live-test-" << getpid();
+    std::string clipFile = prefix.str() + "-clip.ts";
+    std::string fifoPath = prefix.str() + "-feed";
+    std::string outputFile = prefix.str() + "-out.ts";
+    
+    if(writeSyntheticClip(clipFile, "mpeg4", 320, 240, 50, paintGradient, NULL) < 0) return 1;
+    std::ifstream clip(clipFile.c_str(), std::ios::binary);
+    std::vector<uint8_t> stream((std::istreambuf_iterator<char>(clip)), std::istreambuf_iterator<char>());
+    unlink(clipFile.c_str());
+    
+    Transcoder transcoder = Transcoder();
+    LiveInput input = {};
+    input.readTimeout = READ_TIMEOUT;
+    
+    if(mkfifo(fifoPath.c_str(), 0600) == 0) {
+        input.url = fifoPath;
+        std::thread writer(writeFifo, fifoPath, &stream);
+        checkLive(transcoder, input, outputFile, "fifo", WRITER_HOLD_MILLISECONDS * 1000);
+        writer.join();
+        unlink(fifoPath.c_str());
+    } else {
+        expect(false, "fifo: mkfifo succeeds");
+    }
+    
+    int port = 20000 + getpid() % 20000;
+    std::ostringstream udpUrl;
+    udpUrl << "udp://127.0.0.1:" << port;
+    input.url = udpUrl.str();
+    std::thread sender(writeUdp, port, &stream);
+    checkLive(transcoder, input, outputFile, "udp", 10 * 1000 * 1000);
+    sender.join();
+    
+    std::cout << (failures ? "live test failed \n" : "live test passed \n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+//
+//  outputcache_test.cpp
+//  ffmpeg-experiments
+//
+//  Runs the same job through the output cache twice and checks miss, hit, eviction
+//  under a tiny size limit, read-only entries and that no partial files are left behind.
+//
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "outputcache.hpp"
+#include "syntheticclip.hpp"
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string &what) {
+    if(!condition) {
+        std::cout << "failed: " << what << "\n";
+        failures++;
+    }
+}
+
+static std::vector<std::string> listDirectory(const std::string &path) {
+    std::vector<std::string> names;
+    DIR *dir = opendir(path.c_str());
+    if(!dir) return names;
+    struct dirent *file;
+    while((file = readdir(dir)) != NULL) {
+        std::string name = file->d_name;
+        if(name != "." && name != "..") names.push_back(name);
+    }
+    closedir(dir);
+    return names;
+}
+
+static bool hasPartials(const std::string &path) {
+    std::vector<std::string> names = listDirectory(path);
+    for(size_t i = 0; i < names.size(); i++) {
+        if(names[i].compare(0, 9, ".partial-") == 0) return true;
+    }
+    return false;
+}
+
+static void removeDirectory(const std::string &path) {
+    std::vector<std::string> names = listDirectory(path);
+    for(size_t i = 0; i < names.size(); i++) {
+        unlink((path + "/" + names[i]).c_str());
+    }
+    rmdir(path.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::ostringstream prefix;
+    prefix << "/tmp/outputcache-test-" << getpid();
+    std::string workDirectory = prefix.str();
+    std::string cacheDirectory = workDirectory + "/cache";
+    std::string smallCacheDirectory = workDirectory + "/small-cache";
+    mkdir(workDirectory.c_str(), 0755);
+    
+    std::string inputFile = workDirectory + "/clip.mkv";
+    std::string firstOutput = workDirectory + "/first.mkv";
+    std::string secondOutput = workDirectory + "/second.mkv";
+    if(writeSyntheticClip(inputFile, "mpeg4", 160, 120, 10, paintGradient, NULL) < 0) return 1;
+    
+    StreamParams streamParams = {};
+    streamParams.copyAudio = true;
+    streamParams.videoCodec = "mpeg4";
+    streamParams.outputExtenstion = "mkv";
+    Transcoder transcoder = Transcoder();
+    
+    {
+        OutputCache cache(cacheDirectory, 1024 * 1024 * 1024);
+        expect(cache.Transcode(transcoder, inputFile, firstOutput, streamParams) == 0, "first transcode succeeds");
+        expect(cache.Transcode(transcoder, inputFile, secondOutput, streamParams) == 0, "second transcode succeeds");
+        CacheStats stats = cache.getStats();
+        expect(stats.misses == 1 && stats.hits == 1, "one miss followed by one hit");
+        
+        struct stat first, second;
+        bool bothExist = stat(firstOutput.c_str(), &first) == 0 && stat(secondOutput.c_str(), &second) == 0;
+        expect(bothExist && first.st_size == second.st_size && stats.bytesServed == (uint64_t) second.st_size, "the hit serves the cached output");
+        expect(bothExist && first.st_ino != second.st_ino, "outputs do not share an inode");
+        
+        std::vector<std::string> entries = listDirectory(cacheDirectory);
+        struct stat entry;
+        expect(entries.size() == 1 && stat((cacheDirectory + "/" + entries[0]).c_str(), &entry) == 0 && (entry.st_mode & 0777) == 0444,
+               "the cache holds one read-only entry");
+        expect(!hasPartials(cacheDirectory) && !hasPartials(workDirectory), "no partial files are left behind");
+        
+        // a hit would skip the measurement, so jobs measuring quality always transcode
+        StreamParams measuringParams = streamParams;
+        measuringParams.qualityLogFile = workDirectory + "/quality.log";
+        expect(cache.Transcode(transcoder, inputFile, secondOutput, measuringParams) == 0, "transcode measuring quality succeeds");
+        stats = cache.getStats();
+        expect(stats.misses == 2 && stats.hits == 1, "jobs measuring quality bypass the cache");
+        expect(stat(measuringParams.qualityLogFile.c_str(), &second) == 0 && second.st_size > 0, "the quality log is written");
+    }
+    {
+        // every entry is larger than the limit, so it is evicted right after publishing
+        OutputCache cache(smallCacheDirectory, 1);
+        expect(cache.Transcode(transcoder, inputFile, firstOutput, streamParams) == 0, "transcode with a tiny cache succeeds");
+        expect(cache.Transcode(transcoder, inputFile, secondOutput, streamParams) == 0, "repeated transcode with a tiny cache succeeds");
+        CacheStats stats = cache.getStats();
+        expect(stats.misses == 2 && stats.hits == 0 && stats.evictions == 2, "entries over the size limit are evicted");
+        expect(listDirectory(smallCacheDirectory).empty(), "the tiny cache is empty");
+    }
+    
+    removeDirectory(cacheDirectory);
+    removeDirectory(smallCacheDirectory);
+    removeDirectory(workDirectory);
+    std::cout << (failures ? "output cache test failed \n" : "output cache test passed \n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+//
+//  qualitymetrics_test.cpp
+//  ffmpeg-experiments
+//
+//  Checks the PSNR and SSIM kernels against plain scalar references and known values,
+//  on planes with odd sizes and padded strides so the vector loops and their tails both run.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <math.h>
+#include <stdlib.h>
+#include "qualitymetrics.hpp"
+
+static const int WIDTH = 37;
+static const int HEIGHT = 23;
+static const int STRIDE = 48;
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string &what) {
+    if(!condition) {
+        std::cout << "failed: " << what << "\n";
+        failures++;
+    }
+}
+
+static uint64_t referenceSquaredError(const uint8_t *a, const uint8_t *b, int length) {
+    uint64_t sum = 0;
+    for(int i = 0; i < length; i++) {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+static double referenceSsim(const uint8_t *a, const uint8_t *b, int stride, int width, int height) {
+    // every 8x8 window on the 4 pixel grid, summed directly from the pixels
+    const double c1 = 0.01 * 0.01 * 255 * 255 * 64;
+    const double c2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+    double total = 0;
+    int windows = 0;
+    for(int top = 0; top + 8 <= height / 4 * 4; top += 4) {
+        for(int left = 0; left + 8 <= width / 4 * 4; left += 4) {
+            double s1 = 0, s2 = 0, ss = 0, s12 = 0;
+            for(int y = top; y < top + 8; y++) {
+                for(int x = left; x < left + 8; x++) {
+                    int pa = a[y * stride + x], pb = b[y * stride + x];
+                    s1 += pa;
+                    s2 += pb;
+                    ss += pa * pa + pb * pb;
+                    s12 += pa * pb;
+                }
+            }
+            double variance = ss * 64 - s1 * s1 - s2 * s2;
+            double covariance = s12 * 64 - s1 * s2;
+            total += ((2 * s1 * s2 + c1) * (2 * covariance + c2)) / ((s1 * s1 + s2 * s2 + c1) * (variance + c2));
+            windows++;
+        }
+    }
+    return total / windows;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<uint8_t> source(STRIDE * HEIGHT), noisy(STRIDE * HEIGHT), offset(STRIDE * HEIGHT);
+    unsigned seed = 12345;
+    for(size_t i = 0; i < source.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        source[i] = (uint8_t) (16 + (seed >> 16) % 200);
+        noisy[i] = (uint8_t) (source[i] + (int) ((seed >> 8) % 9) - 4);
+        offset[i] = (uint8_t) (source[i] + 3);
+    }
+    
+    uint64_t identical = 0, offsetError = 0, noisyError = 0, noisyReference = 0;
+    for(int y = 0; y < HEIGHT; y++) {
+        const uint8_t *row = &source[y * STRIDE];
+        identical += QualityMonitor::sumSquaredError(row, row, WIDTH);
+        offsetError += QualityMonitor::sumSquaredError(row, &offset[y * STRIDE], WIDTH);
+        noisyError += QualityMonitor::sumSquaredError(row, &noisy[y * STRIDE], WIDTH);
+        noisyReference += referenceSquaredError(row, &noisy[y * STRIDE], WIDTH);
+    }
+    expect(identical == 0, "identical planes have no squared error");
+    expect(isinf(QualityMonitor::psnrFromMse((double) identical / (WIDTH * HEIGHT))), "identical planes have infinite PSNR");
+    expect(offsetError == 9ull * WIDTH * HEIGHT, "an offset of 3 gives an MSE of 9");
+    expect(fabs(QualityMonitor::psnrFromMse(9) - 10 * log10(255.0 * 255.0 / 9)) < 1e-12, "PSNR of an MSE of 9");
+    expect(noisyError == noisyReference, "squared error matches the scalar reference");
+    
+    double sameSsim = QualityMonitor::ssimPlane(source.data(), STRIDE, source.data(), STRIDE, WIDTH, HEIGHT);
+    double noisySsim = QualityMonitor::ssimPlane(source.data(), STRIDE, noisy.data(), STRIDE, WIDTH, HEIGHT);
+    double noisyReferenceSsim = referenceSsim(source.data(), noisy.data(), STRIDE, WIDTH, HEIGHT);
+    expect(fabs(sameSsim - 1) < 1e-12, "identical planes have SSIM 1");
+    expect(noisySsim < 1 && fabs(noisySsim - noisyReferenceSsim) < 1e-9, "SSIM matches the scalar reference");
+    
+    std::cout << (failures ? "quality metrics test failed \n" : "quality metrics test passed \n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+//
+//  syntheticclip.cpp
+//  ffmpeg-experiments
+//
+
+#include "syntheticclip.hpp"
+#include <iostream>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+static int writePackets(AVCodecContext *context, AVFormatContext *format, AVStream *stream, AVFrame *frame, AVPacket *packet) {
+    int response = avcodec_send_frame(context, frame);
+    while(response >= 0) {
+        response = avcodec_receive_packet(context, packet);
+        if(response == AVERROR(EAGAIN) || response == AVERROR_EOF) break;
+        if(response < 0) return -1;
+        packet->stream_index = stream->index;
+        av_packet_rescale_ts(packet, context->time_base, stream->time_base);
+        if(av_interleaved_write_frame(format, packet) < 0) return -1;
+    }
+    return 0;
+}
+
+int writeSyntheticClip(const std::string &fileName, const std::string &codecName, int width, int height, int frameCount, FramePainter paint, void *opaque) {
+    /**
+        Encodes frameCount yuv420p frames at 25 fps into fileName, the container is guessed from its extension
+        @param codecName: the encoder to use, for example "ffv1" for a lossless clip
+        @param paint: fills each frame before it is encoded
+        @returns 0 if successful, -1 if an error occured
+     */
+    AVFormatContext *format = NULL;
+    AVCodecContext *context = NULL;
+    AVFrame *frame = NULL;
+    AVPacket *packet = NULL;
+    int ret = -1;
+    
+    AVCodec *codec = avcodec_find_encoder_by_name(codecName.c_str());
+    avformat_alloc_output_context2(&format, NULL, NULL, fileName.c_str());
+    if(!codec || !format) {
+        std::cout << "could not set up synthetic clip " << fileName << "\n";
+        avformat_free_context(format);
+        return -1;
+    }
+    AVStream *stream = avformat_new_stream(format, NULL);
+    context = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+    if(stream && context && frame && packet) {
+        context->width = width;
+        context->height = height;
+        context->pix_fmt = AV_PIX_FMT_YUV420P;
+        context->time_base = (AVRational){1, 25};
+        context->framerate = (AVRational){25, 1};
+        context->gop_size = 12;
+        if(format->oformat->flags & AVFMT_GLOBALHEADER) {
+            context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+        frame->format = context->pix_fmt;
+        frame->width = width;
+        frame->height = height;
+        
+        if(avcodec_open2(context, codec, NULL) == 0 &&
+           avcodec_parameters_from_context(stream->codecpar, context) >= 0 &&
+           av_frame_get_buffer(frame, 0) == 0 &&
+           avio_open(&format->pb, fileName.c_str(), AVIO_FLAG_WRITE) >= 0) {
+            stream->time_base = context->time_base;
+            ret = avformat_write_header(format, NULL) < 0 ? -1 : 0;
+            for(int i = 0; i < frameCount && ret == 0; i++) {
+                if(av_frame_make_writable(frame) < 0) {
+                    ret = -1;
+                    break;
+                }
+                paint(frame, i, opaque);
+                frame->pts = i;
+                ret = writePackets(context, format, stream, frame, packet);
+            }
+            if(ret == 0) ret = writePackets(context, format, stream, NULL, packet);
+            if(ret == 0) av_write_trailer(format);
+            avio_closep(&format->pb);
+        }
+    }
+    if(ret < 0) std::cout << "could not write synthetic clip " << fileName << "\n";
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&context);
+    avformat_free_context(format);
+    return ret;
+}
+
+void paintGradient(AVFrame *frame, int index, void *opaque) {
+    /**
+        A diagonal gradient that moves every frame, so no two frames are alike
+     */
+    for(int y = 0; y < frame->height; y++) {
+        for(int x = 0; x < frame->width; x++) {
+            frame->data[0][y * frame->linesize[0] + x] = (uint8_t) (x + y + index * 3);
+        }
+    }
+    for(int y = 0; y < frame->height / 2; y++) {
+        for(int x = 0; x < frame->width / 2; x++) {
+            frame->data[1][y * frame->linesize[1] + x] = 128;
+            frame->data[2][y * frame->linesize[2] + x] = (uint8_t) (64 + index);
+        }
+    }
+}
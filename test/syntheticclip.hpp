@@ -0,0 +1,24 @@
+//
+//  syntheticclip.hpp
+//  ffmpeg-experiments
+//
+//  Writes generated video clips, so the benchmark and tests need no media files.
+//
+#pragma once
+#ifndef syntheticclip_hpp
+#define syntheticclip_hpp
+
+#include <string>
+
+#define __STDC_CONSTANT_MACROS
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+// fills the planes of a writable yuv420p frame for frame number index
+typedef void (*FramePainter)(AVFrame *frame, int index, void *opaque);
+
+int writeSyntheticClip(const std::string &fileName, const std::string &codecName, int width, int height, int frameCount, FramePainter paint, void *opaque);
+void paintGradient(AVFrame *frame, int index, void *opaque);
+
+#endif /* syntheticclip_hpp */
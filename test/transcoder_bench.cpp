@@ -0,0 +1,116 @@
+//
+//  transcoder_bench.cpp
+//  ffmpeg-experiments
+//
+//  Compares the in-memory transcode API with a temp-file round trip on small clips,
+//  where the disk round trip is a large share of the job. Then compares decode speed and
+//  page faults of the default frame allocator with pooled and huge page backed buffers
+//  on a large clip.
+//
+//  usage: transcoder-bench [iterations] [frames] [large frames]
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include "transcoder.hpp"
+#include "syntheticclip.hpp"
+
+extern "C" {
+    #include <libavutil/time.h>
+}
+
+static int readFile(const std::string &fileName, std::vector<uint8_t> &data) {
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if(!file) return -1;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return 0;
+}
+
+static int benchAllocators(Transcoder &transcoder, const std::string &prefix, int frames) {
+    /**
+        Transcodes a 1080p clip with each frame allocator and reports decode fps and page faults
+        inside the decode calls, from getDecodeStats
+     */
+    std::string clipFile = prefix + "-large.mkv";
+    std::string outputFile = prefix + "-large-out.mkv";
+    if(writeSyntheticClip(clipFile, "mpeg4", 1920, 1080, frames, paintGradient, NULL) < 0) return -1;
+    
+    const char *names[3] = {"default", "pooled", "pooled, huge pages"};
+    int ret = 0;
+    for(int allocator = 0; allocator < 3 && ret == 0; allocator++) {
+        StreamParams streamParams = {};
+        streamParams.copyAudio = true;
+        streamParams.videoCodec = "mpeg4";
+        streamParams.outputExtenstion = "mkv";
+        streamParams.pooledFrameBuffers = allocator > 0;
+        streamParams.hugePageFrameBuffers = allocator == 2;
+        ret = transcoder.Transcode(clipFile, outputFile, streamParams);
+        DecodeStats stats = transcoder.getDecodeStats();
+        double fps = stats.decodeMicroseconds > 0 ? stats.framesDecoded * 1000000.0 / stats.decodeMicroseconds : 0;
+        std::cout << names[allocator] << " allocator: " << fps << " fps decoding, " << stats.pageFaults << " page faults while decoding \n";
+        unlink(outputFile.c_str());
+    }
+    unlink(clipFile.c_str());
+    return ret;
+}
+
+static int writeFile(const std::string &fileName, const std::vector<uint8_t> &data) {
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    file.write((const char*) data.data(), data.size());
+    return file ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    int frames = argc > 2 ? atoi(argv[2]) : 25;
+    int largeFrames = argc > 3 ? atoi(argv[3]) : 100;
+    
+    std::ostringstream prefix;
+    prefix << "/tmp/transcoder-bench-" << getpid();
+    std::string clipFile = prefix.str() + "-clip.mkv";
+    if(writeSyntheticClip(clipFile, "mpeg4", 320, 240, frames, paintGradient, NULL) < 0) return 1;
+    std::vector<uint8_t> clip;
+    if(readFile(clipFile, clip) < 0) return 1;
+    unlink(clipFile.c_str());
+    
+    StreamParams streamParams = {};
+    streamParams.copyAudio = true;
+    streamParams.videoCodec = "mpeg4";
+    streamParams.outputExtenstion = "mkv";
+    Transcoder transcoder = Transcoder();
+    
+    // in memory: buffer in, vector out
+    int64_t memoryTime = 0;
+    std::vector<uint8_t> output;
+    for(int i = 0; i < iterations; i++) {
+        int64_t start = av_gettime_relative();
+        if(transcoder.Transcode(clip.data(), clip.size(), output, streamParams) < 0) return 1;
+        memoryTime += av_gettime_relative() - start;
+    }
+    size_t memoryBytes = output.size();
+    
+    // temp files: write the upload to disk, transcode file to file, read the result back
+    int64_t fileTime = 0;
+    std::string inputFile = prefix.str() + "-in.mkv";
+    std::string outputFile = prefix.str() + "-out.mkv";
+    for(int i = 0; i < iterations; i++) {
+        int64_t start = av_gettime_relative();
+        if(writeFile(inputFile, clip) < 0) return 1;
+        if(transcoder.Transcode(inputFile, outputFile, streamParams) < 0) return 1;
+        if(readFile(outputFile, output) < 0) return 1;
+        unlink(inputFile.c_str());
+        unlink(outputFile.c_str());
+        fileTime += av_gettime_relative() - start;
+    }
+    
+    std::cout << "clip: " << frames << " frames, " << clip.size() << " bytes in, " << memoryBytes << " bytes out \n";
+    std::cout << "in memory: " << memoryTime / iterations / 1000.0 << "ms per transcode \n";
+    std::cout << "temp file: " << fileTime / iterations / 1000.0 << "ms per transcode \n";
+    
+    if(benchAllocators(transcoder, prefix.str(), largeFrames) < 0) return 1;
+    return 0;
+}